@@ -0,0 +1,223 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "loop.h"
+#include "control.h"
+#include "log.h"
+
+static void control_drop(control_client_t *cl)
+{
+	control_t *ctl = cl->ctl;
+	control_client_t **p;
+
+	for(p = &ctl->clients; *p; p = &(*p)->next)
+	{
+		if(*p != cl) continue;
+		*p = cl->next;
+		break;
+	}
+
+	loop_unwatch(ctl->loop, cl->watch);
+	free(cl);
+}
+
+static void control_reply(control_client_t *cl, char *reply)
+{
+	size_t length = strlen(reply);
+
+	/* Replies are short; a client that is not reading loses them. */
+	reply[length++] = '\n';
+	if(send(cl->fd, reply, length, MSG_DONTWAIT | MSG_NOSIGNAL) == -1)
+		DEBUG("Control reply lost: %s", strerror(errno));
+}
+
+static int control_read(void *arg, uint32_t events)
+{
+	control_client_t *cl = (control_client_t *) arg;
+	char reply[CONTROL_LINE * 4 + 1];
+	char *end;
+	ssize_t r;
+
+	r = read(cl->fd, cl->line + cl->length, CONTROL_LINE - cl->length);
+	if(r == -1 && (errno == EAGAIN || errno == EINTR)) return(0);
+	if(r <= 0)
+	{
+		control_drop(cl);
+		return(0);
+	}
+
+	cl->length += r;
+
+	while((end = memchr(cl->line, '\n', cl->length)))
+	{
+		size_t used = end - cl->line + 1;
+
+		*end = '\0';
+		if(end > cl->line && end[-1] == '\r') end[-1] = '\0';
+
+		/* Leave room for the newline control_reply() adds. */
+		reply[0] = '\0';
+		cl->ctl->fn(cl->ctl->arg, cl->line, reply, sizeof(reply) - 1);
+		control_reply(cl, reply);
+
+		cl->length -= used;
+		memmove(cl->line, cl->line + used, cl->length);
+	}
+
+	if(cl->length == CONTROL_LINE)
+	{
+		strcpy(reply, "error line too long");
+		control_reply(cl, reply);
+		cl->length = 0;
+	}
+
+	return(0);
+}
+
+static int control_accept(void *arg, uint32_t events)
+{
+	control_t *ctl = (control_t *) arg;
+	control_client_t *cl;
+	int fd;
+
+	fd = accept4(ctl->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if(fd == -1)
+	{
+		WARN("accept: %s", strerror(errno));
+		return(0);
+	}
+
+	cl = calloc(1, sizeof(control_client_t));
+	if(!cl)
+	{
+		ERROR("Out of memory.");
+		close(fd);
+		return(0);
+	}
+
+	cl->ctl = ctl;
+	cl->fd  = fd;
+
+	cl->watch = loop_watch(ctl->loop, fd, EPOLLIN, control_read, cl);
+	if(!cl->watch)
+	{
+		close(fd);
+		free(cl);
+		return(0);
+	}
+
+	/* The loop closes the descriptor with the watch. */
+	cl->watch->owned = 1;
+
+	cl->next = ctl->clients;
+	ctl->clients = cl;
+
+	return(0);
+}
+
+control_t *control_open(fswc_loop_t *l, char *path, control_fn_t fn, void *arg)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	control_t *ctl;
+
+	if(strlen(path) >= sizeof(addr.sun_path))
+	{
+		ERROR("Control socket path is too long: %s", path);
+		return(NULL);
+	}
+
+	/* Remove a socket left behind by a previous run, but nothing
+	 * else that may be there. */
+	if(!lstat(path, &st))
+	{
+		if(!S_ISSOCK(st.st_mode))
+		{
+			ERROR("%s exists and is not a socket.", path);
+			return(NULL);
+		}
+
+		unlink(path);
+	}
+
+	ctl = calloc(1, sizeof(control_t));
+	if(!ctl)
+	{
+		ERROR("Out of memory.");
+		return(NULL);
+	}
+
+	ctl->loop = l;
+	ctl->path = path;
+	ctl->fn   = fn;
+	ctl->arg  = arg;
+
+	ctl->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(ctl->fd == -1)
+	{
+		ERROR("socket: %s", strerror(errno));
+		free(ctl);
+		return(NULL);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if(bind(ctl->fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+	   listen(ctl->fd, 4) == -1)
+	{
+		ERROR("Unable to listen on %s: %s", path, strerror(errno));
+		close(ctl->fd);
+		free(ctl);
+		return(NULL);
+	}
+
+	ctl->watch = loop_watch(l, ctl->fd, EPOLLIN, control_accept, ctl);
+	if(!ctl->watch)
+	{
+		close(ctl->fd);
+		unlink(path);
+		free(ctl);
+		return(NULL);
+	}
+
+	ctl->watch->owned = 1;
+
+	MSG("Listening for commands on %s.", path);
+
+	return(ctl);
+}
+
+void control_close(control_t *ctl)
+{
+	if(!ctl) return;
+
+	while(ctl->clients) control_drop(ctl->clients);
+
+	loop_unwatch(ctl->loop, ctl->watch);
+	unlink(ctl->path);
+
+	free(ctl);
+}
+
@@ -0,0 +1,55 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_CONTROL_H
+#define INC_CONTROL_H
+
+#include <stddef.h>
+#include "loop.h"
+
+/* Longest command line accepted from a client. */
+#define CONTROL_LINE (256)
+
+/* Called for each line received, without its line ending. The reply
+ * written to 'reply' (at most 'size' bytes including the nul) is sent
+ * back followed by a newline. */
+typedef int (*control_fn_t)(void *arg, char *line, char *reply, size_t size);
+
+typedef struct control_client {
+
+	struct control *ctl;
+	int fd;
+	fswc_watch_t *watch;
+
+	char line[CONTROL_LINE];
+	size_t length;
+
+	struct control_client *next;
+
+} control_client_t;
+
+typedef struct control {
+
+	fswc_loop_t *loop;
+	char *path;
+	int fd;
+	fswc_watch_t *watch;
+
+	control_fn_t fn;
+	void *arg;
+
+	control_client_t *clients;
+
+} control_t;
+
+extern control_t *control_open(fswc_loop_t *l, char *path, control_fn_t fn, void *arg);
+extern void control_close(control_t *ctl);
+
+#endif
+
@@ -11,70 +11,89 @@
 #include "config.h"
 #endif
 
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <setjmp.h>
 #include <gd.h>
+#include <jpeglib.h>
+#include <jerror.h>
 #include "fswebcam.h"
 #include "src.h"
 #include "log.h"
 
-int verify_jpeg_dht(uint8_t *src,  uint32_t lsrc,
-                    uint8_t **dst, uint32_t *ldst)
+/* libjpeg-turbo 1.5 and later can skip rows and columns of a frame
+ * without decoding them. Otherwise they are decoded and discarded. */
+#if defined(LIBJPEG_TURBO_VERSION_NUMBER) && LIBJPEG_TURBO_VERSION_NUMBER >= 1005000
+#define JPEG_CAN_CROP
+#endif
+
+/* When more than REDUCE_BUSY in 4 rows of cells changed, the coarse
+ * pass costs more than it saves, and the next REDUCE_HOLD frames are
+ * decoded whole without one. */
+#define REDUCE_BUSY (3)
+#define REDUCE_HOLD (16)
+
+typedef struct {
+	struct jpeg_error_mgr pub;
+	jmp_buf env;
+} fswc_jpeg_error_t;
+
+/* The Huffman tables MJPEG frames leave out. This is based on a patch
+ * provided by Scott J. Bertin. */
+static uint8_t dht[] =
+{
+	0xff, 0xc4, 0x01, 0xa2, 0x00, 0x00, 0x01, 0x05, 0x01, 0x01,
+	0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+	0x09, 0x0a, 0x0b, 0x10, 0x00, 0x02, 0x01, 0x03, 0x03, 0x02,
+	0x04, 0x03, 0x05, 0x05, 0x04, 0x04, 0x00, 0x00, 0x01, 0x7d,
+	0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31,
+	0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32,
+	0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52,
+	0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+	0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a,
+	0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45,
+	0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57,
+	0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+	0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83,
+	0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94,
+	0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+	0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+	0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+	0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8,
+	0xd9, 0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8,
+	0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+	0xf9, 0xfa, 0x01, 0x00, 0x03, 0x01, 0x01, 0x01, 0x01, 0x01,
+	0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
+	0x0b, 0x11, 0x00, 0x02, 0x01, 0x02, 0x04, 0x04, 0x03, 0x04,
+	0x07, 0x05, 0x04, 0x04, 0x00, 0x01, 0x02, 0x77, 0x00, 0x01,
+	0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41,
+	0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14,
+	0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+	0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25,
+	0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a,
+	0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46,
+	0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+	0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+	0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83,
+	0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94,
+	0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+	0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+	0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+	0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8,
+	0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+	0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa
+};
+
+uint32_t fswc_jpeg_dht(uint8_t *src, uint32_t lsrc, uint32_t *at, uint8_t **seg)
 {
-	/* This function is based on a patch provided by Scott J. Bertin. */
-
-	static unsigned char dht[] =
-	{
-		0xff, 0xc4, 0x01, 0xa2, 0x00, 0x00, 0x01, 0x05, 0x01, 0x01,
-		0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
-		0x09, 0x0a, 0x0b, 0x10, 0x00, 0x02, 0x01, 0x03, 0x03, 0x02,
-		0x04, 0x03, 0x05, 0x05, 0x04, 0x04, 0x00, 0x00, 0x01, 0x7d,
-		0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31,
-		0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32,
-		0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52,
-		0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
-		0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a,
-		0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45,
-		0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57,
-		0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
-		0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83,
-		0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94,
-		0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
-		0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
-		0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
-		0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8,
-		0xd9, 0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8,
-		0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
-		0xf9, 0xfa, 0x01, 0x00, 0x03, 0x01, 0x01, 0x01, 0x01, 0x01,
-		0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
-		0x0b, 0x11, 0x00, 0x02, 0x01, 0x02, 0x04, 0x04, 0x03, 0x04,
-		0x07, 0x05, 0x04, 0x04, 0x00, 0x01, 0x02, 0x77, 0x00, 0x01,
-		0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41,
-		0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14,
-		0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
-		0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25,
-		0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a,
-		0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46,
-		0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
-		0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
-		0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83,
-		0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94,
-		0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
-		0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
-		0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
-		0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8,
-		0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
-		0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa
-	};
+	/* Returns the length of the DHT segment to insert at *at, or 0
+	 * if the frame has its own Huffman tables. */
 	uint8_t *p, *i = NULL;
 
-	/* By default we simply return the source image. */
-	*dst = src;
-	*ldst = lsrc;
-
 	/* Scan for an existing DHT segment or the first SOS segment. */
 	for(p = src + 2; p - src < lsrc - 3 && i == NULL; )
 	{
@@ -91,9 +110,28 @@ int verify_jpeg_dht(uint8_t *src,  uint32_t lsrc,
 	/* If no SOS was found, insert the DHT directly after the SOI. */
 	if(i == NULL) i = src + 2;
 
+	*at  = i - src;
+	*seg = dht;
+
+	return(sizeof(dht));
+}
+
+int verify_jpeg_dht(uint8_t *src,  uint32_t lsrc,
+                    uint8_t **dst, uint32_t *ldst)
+{
+	uint8_t *p, *seg;
+	uint32_t at, l;
+
+	/* By default we simply return the source image. */
+	*dst = src;
+	*ldst = lsrc;
+
+	l = fswc_jpeg_dht(src, lsrc, &at, &seg);
+	if(!l) return(0);
+
 	DEBUG("Inserting DHT segment into JPEG frame.");
 
-	*ldst = lsrc + sizeof(dht);
+	*ldst = lsrc + l;
 	*dst  = malloc(*ldst);
 	if(!*dst)
 	{
@@ -102,13 +140,576 @@ int verify_jpeg_dht(uint8_t *src,  uint32_t lsrc,
 	}
 
 	/* Copy the JPEG data, inserting the DHT segment. */
-	memcpy((p  = *dst), src, i - src);
-	memcpy((p += i - src), dht, sizeof(dht));
-	memcpy((p += sizeof(dht)), i, lsrc - (i - src));
+	memcpy((p  = *dst), src, at);
+	memcpy((p += at), seg, l);
+	memcpy((p += l), src + at, lsrc - at);
 
 	return(1);
 }
 
+static void fswc_jpeg_error_exit(j_common_ptr cinfo)
+{
+	fswc_jpeg_error_t *err = (fswc_jpeg_error_t *) cinfo->err;
+	char msg[JMSG_LENGTH_MAX];
+	
+	(*cinfo->err->format_message)(cinfo, msg);
+	WARN("Error decoding frame: %s", msg);
+	
+	longjmp(err->env, 1);
+}
+
+static void fswc_jpeg_output_message(j_common_ptr cinfo)
+{
+	/* Warnings about corrupt data are ignored, as gd does. */
+}
+
+/* A libjpeg decompressor kept from frame to frame. Frames are read in
+ * place, with any missing DHT segment served between their bytes, and
+ * the buffers it decodes into only grow. */
+struct fswc_decoder {
+	
+	struct jpeg_decompress_struct cinfo;
+	fswc_jpeg_error_t jerr;
+	struct jpeg_source_mgr src;
+	
+	/* The frame up to the DHT segment, the segment, and the rest. */
+	const uint8_t *piece[3];
+	size_t piece_length[3];
+	int next;
+	
+	JSAMPROW line[1];
+	uint32_t line_size;
+	uint32_t *sum;
+	uint32_t sum_size;
+	
+	uint8_t *scratch;
+	uint32_t scratch_size;
+	
+	/* For gated reduction, each tile's value when it was last decoded
+	 * followed by its value in this frame, and which tiles changed
+	 * followed by which rows of cells are needed. Each cell as it was
+	 * last decoded, and frames left to decode whole. */
+	avgbmp_t *coarse;
+	uint32_t coarse_size;
+	uint32_t tiles;
+	uint8_t *changed;
+	uint32_t changed_size;
+	avgbmp_t *last;
+	uint32_t last_size;
+	uint32_t cells;
+	uint32_t busy;
+	
+};
+
+static void fswc_source_init(j_decompress_ptr cinfo)
+{
+	fswc_decoder_t *d = (fswc_decoder_t *) cinfo->client_data;
+	
+	d->next = 0;
+	d->src.next_input_byte = NULL;
+	d->src.bytes_in_buffer = 0;
+}
+
+static boolean fswc_source_fill(j_decompress_ptr cinfo)
+{
+	static const JOCTET eoi[] = { 0xFF, JPEG_EOI };
+	fswc_decoder_t *d = (fswc_decoder_t *) cinfo->client_data;
+	
+	while(d->next < 3 && !d->piece_length[d->next]) d->next++;
+	
+	if(d->next < 3)
+	{
+		d->src.next_input_byte = d->piece[d->next];
+		d->src.bytes_in_buffer = d->piece_length[d->next];
+		d->next++;
+		return(TRUE);
+	}
+	
+	/* A frame cut short is ended as jpeg_mem_src() does. */
+	WARNMS(cinfo, JWRN_JPEG_EOF);
+	
+	d->src.next_input_byte = eoi;
+	d->src.bytes_in_buffer = 2;
+	
+	return(TRUE);
+}
+
+static void fswc_source_skip(j_decompress_ptr cinfo, long n)
+{
+	fswc_decoder_t *d = (fswc_decoder_t *) cinfo->client_data;
+	
+	if(n <= 0) return;
+	
+	while(n > (long) d->src.bytes_in_buffer)
+	{
+		n -= d->src.bytes_in_buffer;
+		fswc_source_fill(cinfo);
+	}
+	
+	d->src.next_input_byte += n;
+	d->src.bytes_in_buffer -= n;
+}
+
+static void fswc_source_term(j_decompress_ptr cinfo)
+{
+}
+
+static void *fswc_decoder_grow(void **buf, uint32_t *size, uint32_t need)
+{
+	void *p;
+	
+	if(need <= *size) return(*buf);
+	
+	p = realloc(*buf, need);
+	if(!p)
+	{
+		ERROR("Out of memory.");
+		return(NULL);
+	}
+	
+	*buf  = p;
+	*size = need;
+	
+	return(p);
+}
+
+fswc_decoder_t *fswc_decoder_new(void)
+{
+	fswc_decoder_t *d;
+	
+	d = calloc(1, sizeof(fswc_decoder_t));
+	if(!d)
+	{
+		ERROR("Out of memory.");
+		return(NULL);
+	}
+	
+	d->cinfo.err = jpeg_std_error(&d->jerr.pub);
+	d->jerr.pub.error_exit     = fswc_jpeg_error_exit;
+	d->jerr.pub.output_message = fswc_jpeg_output_message;
+	
+	if(setjmp(d->jerr.env))
+	{
+		jpeg_destroy_decompress(&d->cinfo);
+		free(d);
+		return(NULL);
+	}
+	
+	jpeg_create_decompress(&d->cinfo);
+	d->cinfo.client_data = d;
+	
+	d->src.init_source       = fswc_source_init;
+	d->src.fill_input_buffer = fswc_source_fill;
+	d->src.skip_input_data   = fswc_source_skip;
+	d->src.resync_to_restart = jpeg_resync_to_restart;
+	d->src.term_source       = fswc_source_term;
+	d->cinfo.src = &d->src;
+	
+	return(d);
+}
+
+void fswc_decoder_free(fswc_decoder_t *d)
+{
+	if(!d) return;
+	
+	jpeg_destroy_decompress(&d->cinfo);
+	
+	free(d->line[0]);
+	free(d->sum);
+	free(d->scratch);
+	free(d->coarse);
+	free(d->changed);
+	free(d->last);
+	free(d);
+}
+
+uint8_t *fswc_decoder_scratch(fswc_decoder_t *d, uint32_t size)
+{
+	return(fswc_decoder_grow((void **) &d->scratch, &d->scratch_size, size));
+}
+
+static void fswc_decoder_start(fswc_decoder_t *d, src_t *src)
+{
+	/* Serves the frame, inserting the DHT segment if it has none. */
+	uint8_t *seg = NULL;
+	uint32_t at = src->length, l;
+	
+	l = fswc_jpeg_dht(src->img, src->length, &at, &seg);
+	
+	d->piece[0] = src->img;
+	d->piece_length[0] = at;
+	d->piece[1] = seg;
+	d->piece_length[1] = l;
+	d->piece[2] = src->img + at;
+	d->piece_length[2] = src->length - at;
+	
+	jpeg_read_header(&d->cinfo, TRUE);
+}
+
+static int fswc_reduce_jpeg_dc(fswc_decoder_t *d, src_t *src, avgbmp_t *rbitmap, uint16_t scale, uint32_t rows)
+{
+	/* The DC term of each 8x8 luma block is already the mean of the
+	 * block, so frames are only entropy decoded. There is no IDCT,
+	 * upsampling or colour conversion. */
+	struct jpeg_decompress_struct *cinfo = &d->cinfo;
+	jpeg_component_info *y;
+	jvirt_barray_ptr *coef;
+	JBLOCKARRAY block;
+	uint32_t *sum;
+	uint32_t bx0, by0, bw, bh, n;
+	uint32_t cells, cy, cx, bx, by;
+	int32_t v, q;
+	
+	if(setjmp(d->jerr.env))
+	{
+		jpeg_abort_decompress(cinfo);
+		return(-1);
+	}
+	
+	fswc_decoder_start(d, src);
+	
+	y = &cinfo->comp_info[0];
+	
+	/* Luma must be at full resolution, so its blocks are 8x8 pixels. */
+	if((cinfo->jpeg_color_space != JCS_YCbCr &&
+	    cinfo->jpeg_color_space != JCS_GRAYSCALE) ||
+	   y->h_samp_factor != cinfo->max_h_samp_factor ||
+	   y->v_samp_factor != cinfo->max_v_samp_factor)
+	{
+		jpeg_abort_decompress(cinfo);
+		return(1);
+	}
+	
+	coef = jpeg_read_coefficients(cinfo);
+	q = y->quant_table->quantval[0];
+	
+	/* The region to reduce, in blocks. The offset is rounded down. */
+	n   = scale / DCTSIZE;
+	bx0 = src->roi_x / DCTSIZE;
+	by0 = src->roi_y / DCTSIZE;
+	bw  = ((src->roi_width ? src->roi_width  : src->width)  + DCTSIZE - 1) / DCTSIZE;
+	bh  = ((src->roi_width ? src->roi_height : src->height) + DCTSIZE - 1) / DCTSIZE;
+	cells = (bw + n - 1) / n;
+	
+	if(rows * n < bh) bh = rows * n;
+	
+	sum = fswc_decoder_grow((void **) &d->sum, &d->sum_size, cells * sizeof(uint32_t));
+	if(!sum) longjmp(d->jerr.env, 1);
+	
+	for(cy = 0; cy < bh; cy += n)
+	{
+		memset(sum, 0, cells * sizeof(uint32_t));
+		
+		for(by = by0 + cy; by < by0 + cy + n && by < by0 + bh; by++)
+		{
+			if(by >= y->height_in_blocks) break;
+			
+			block = (*cinfo->mem->access_virt_barray)((j_common_ptr) cinfo,
+			   coef[0], by, 1, FALSE);
+			
+			for(bx = 0; bx < bw && bx0 + bx < y->width_in_blocks; bx++)
+			{
+				/* The DC term is eight times the mean of
+				 * the block, centred on zero. */
+				v = block[0][bx0 + bx][0] * q / DCTSIZE + 128;
+				sum[bx / n] += CLIP(v, 0, 255);
+			}
+		}
+		
+		for(cx = 0; cx < cells; cx++)
+			*(rbitmap++) = sum[cx] / (n * n);
+	}
+	
+	jpeg_finish_decompress(cinfo);
+	
+	return(0);
+}
+
+static int fswc_reduce_jpeg_rows(fswc_decoder_t *d, src_t *src, avgbmp_t *rbitmap,
+                                 uint16_t scale, uint32_t rows, int mode, uint8_t *need)
+{
+	/* Reduces the frame. With need, rows of cells it does not mark
+	 * are skipped over and left as they are, except from the DC terms,
+	 * which are all read anyway. */
+	struct jpeg_decompress_struct *cinfo = &d->cinfo;
+	JSAMPLE *p;
+	JDIMENSION xoff;
+	uint32_t *sum;
+	uint32_t x0, y0, w, h, xw;
+	uint32_t x, y, ys, c, k, v, r, n;
+	uint32_t cells;
+	int i;
+	
+	if(mode == REDUCE_DC && !(scale % DCTSIZE))
+	{
+		i = fswc_reduce_jpeg_dc(d, src, rbitmap, scale, rows);
+		if(i != 1) return(i);
+		
+		/* Otherwise the frame is decoded in full. */
+	}
+	
+	/* The region to reduce, in frame pixels. */
+	x0 = src->roi_x;
+	y0 = src->roi_y;
+	w  = (src->roi_width ? src->roi_width  : src->width);
+	h  = (src->roi_width ? src->roi_height : src->height);
+	cells = (w + scale - 1) / scale;
+	
+	/* Rows of cells below the ones asked for are never decoded. */
+	if(rows * scale < h) h = rows * scale;
+	
+	if(setjmp(d->jerr.env))
+	{
+		jpeg_abort_decompress(cinfo);
+		return(-1);
+	}
+	
+	fswc_decoder_start(d, src);
+	
+	if(cinfo->jpeg_color_space == JCS_CMYK || cinfo->jpeg_color_space == JCS_YCCK)
+	{
+		WARN("CMYK JPEG frames are not supported.");
+		longjmp(d->jerr.env, 1);
+	}
+	
+	/* Each pixel counts as the mean of its red, green and blue. */
+	cinfo->out_color_space = (cinfo->num_components == 1 ? JCS_GRAYSCALE : JCS_RGB);
+	jpeg_start_decompress(cinfo);
+	
+	/* Columns of the region that are inside the frame. */
+	xw = (x0 < cinfo->output_width ? cinfo->output_width - x0 : 0);
+	if(xw > w) xw = w;
+	
+	xoff = 0;
+	
+#ifdef JPEG_CAN_CROP
+	/* Decode only the MCU columns covering the region. libjpeg may
+	 * widen the crop to an MCU boundary, moving xoff left. */
+	if(xw && xw < cinfo->output_width)
+	{
+		JDIMENSION cw = xw;
+		
+		xoff = x0;
+		jpeg_crop_scanline(cinfo, &xoff, &cw);
+	}
+	
+	if(y0) jpeg_skip_scanlines(cinfo, y0);
+#endif
+	
+	if(!fswc_decoder_grow((void **) &d->line[0], &d->line_size,
+	   cinfo->output_width * cinfo->output_components) ||
+	   !fswc_decoder_grow((void **) &d->sum, &d->sum_size,
+	   cells * sizeof(uint32_t)))
+		longjmp(d->jerr.env, 1);
+	
+	sum = d->sum;
+	
+#ifndef JPEG_CAN_CROP
+	while(cinfo->output_scanline < y0 &&
+	      cinfo->output_scanline < cinfo->output_height)
+		jpeg_read_scanlines(cinfo, d->line, 1);
+#endif
+	
+	for(y = 0, r = 0; y < h; y += scale, r++)
+	{
+		if(need && !need[r])
+		{
+			n = (h - y < scale ? h - y : scale);
+			
+#ifdef JPEG_CAN_CROP
+			jpeg_skip_scanlines(cinfo, n);
+#else
+			for(ys = 0; ys < n && cinfo->output_scanline < cinfo->output_height; ys++)
+				jpeg_read_scanlines(cinfo, d->line, 1);
+#endif
+			
+			rbitmap += cells;
+			continue;
+		}
+		
+		memset(sum, 0, cells * sizeof(uint32_t));
+		
+		for(ys = 0; ys < scale && y + ys < h; ys++)
+		{
+			if(cinfo->output_scanline >= cinfo->output_height) break;
+			jpeg_read_scanlines(cinfo, d->line, 1);
+			
+			p = d->line[0] + (x0 - xoff) * cinfo->output_components;
+			
+			for(x = 0, c = 0, k = 0; x < xw; x++)
+			{
+				if(cinfo->output_components == 1) v = *(p++);
+				else
+				{
+					v = (p[0] + p[1] + p[2]) / 3;
+					p += 3;
+				}
+				
+				sum[c] += v;
+				if(++k == scale)
+				{
+					k = 0;
+					c++;
+				}
+			}
+		}
+		
+		for(c = 0; c < cells; c++)
+			*(rbitmap++) = sum[c] / (scale * scale);
+	}
+	
+	/* The rest of the frame is not needed. */
+	jpeg_abort_decompress(cinfo);
+	
+	return(0);
+}
+
+int fswc_reduce_jpeg(fswc_decoder_t *d, src_t *src, avgbmp_t *rbitmap, uint16_t scale, uint32_t rows, int mode)
+{
+	return(fswc_reduce_jpeg_rows(d, src, rbitmap, scale, rows, mode, NULL));
+}
+
+static int fswc_reduce_jpeg_whole(fswc_decoder_t *d, src_t *src, avgbmp_t *rbitmap,
+                                  uint16_t scale, uint32_t rows, int mode, uint32_t cells)
+{
+	/* Reduces the whole frame and keeps its cells for the next. */
+	int i = fswc_reduce_jpeg_rows(d, src, rbitmap, scale, rows, mode, NULL);
+	
+	if(!i) memcpy(d->last, rbitmap, cells * sizeof(avgbmp_t));
+	
+	return(i);
+}
+
+int fswc_reduce_jpeg_gated(fswc_decoder_t *d, src_t *src, avgbmp_t *rbitmap,
+                           uint16_t scale, uint32_t rows, int mode, uint32_t gate)
+{
+	/* A coarse pass over the DC terms finds the tiles that changed by
+	 * more than gate since they were last decoded, and only the rows
+	 * of cells over them and their neighbours are decoded. Cells
+	 * centred away from those tiles keep the values this decoder last
+	 * gave them. Each decoder compares with the frames it decoded
+	 * itself, not with the frames before in sequence, so whichever
+	 * thread decodes a frame, its cells are never further than the
+	 * gate from what they would be. */
+	avgbmp_t *ref, *cur;
+	uint8_t *changed, *need;
+	uint32_t w, h, tw, th, tiles, cells, crows, needed;
+	uint32_t x, y, tx, ty, t, r, c;
+	int i, any = 0;
+	
+	/* Cells read from the DC terms cost no more than the coarse pass. */
+	if(mode == REDUCE_DC && !(scale % DCTSIZE))
+		return(fswc_reduce_jpeg_rows(d, src, rbitmap, scale, rows, mode, NULL));
+	
+	w = (src->roi_width ? src->roi_width  : src->width);
+	h = (src->roi_width ? src->roi_height : src->height);
+	if(rows * scale < h) h = rows * scale;
+	
+	cells = (w + scale - 1) / scale;
+	crows = (h + scale - 1) / scale;
+	tw    = (w + REDUCE_TILE - 1) / REDUCE_TILE;
+	th    = (h + REDUCE_TILE - 1) / REDUCE_TILE;
+	tiles = tw * th;
+	
+	if(!fswc_decoder_grow((void **) &d->coarse, &d->coarse_size, 2 * tiles * sizeof(avgbmp_t)) ||
+	   !fswc_decoder_grow((void **) &d->changed, &d->changed_size, tiles + crows) ||
+	   !fswc_decoder_grow((void **) &d->last, &d->last_size, cells * crows * sizeof(avgbmp_t)))
+		return(-1);
+	
+	ref = d->coarse;
+	cur = d->coarse + tiles;
+	changed = d->changed;
+	need = d->changed + tiles;
+	
+	/* While most of the frame keeps changing, the coarse pass is left
+	 * out. The tiles are then out of date, so the gate starts again. */
+	if(d->busy)
+	{
+		if(!--d->busy) d->tiles = 0;
+		return(fswc_reduce_jpeg_whole(d, src, rbitmap, scale, rows, mode, cells * crows));
+	}
+	
+	i = fswc_reduce_jpeg_dc(d, src, cur, REDUCE_TILE, th);
+	if(i == 1) return(fswc_reduce_jpeg_whole(d, src, rbitmap, scale, rows, mode, cells * crows));
+	if(i) return(i);
+	
+	/* With nothing to compare with, the frame is decoded whole. */
+	if(d->tiles != tiles || d->cells != cells * crows)
+	{
+		i = fswc_reduce_jpeg_whole(d, src, rbitmap, scale, rows, mode, cells * crows);
+		if(i) return(i);
+		
+		memcpy(ref, cur, tiles * sizeof(avgbmp_t));
+		d->tiles = tiles;
+		d->cells = cells * crows;
+		
+		return(0);
+	}
+	
+	/* A change may only just reach into a tile, so its neighbours
+	 * are decoded too. */
+	memset(changed, 0, tiles);
+	
+	for(ty = 0; ty < th; ty++)
+		for(tx = 0; tx < tw; tx++)
+		{
+			t = ty * tw + tx;
+			if(abs((int) cur[t] - (int) ref[t]) <= (int) gate) continue;
+			
+			any = 1;
+			for(y = (ty ? ty - 1 : 0); y <= ty + 1 && y < th; y++)
+				for(x = (tx ? tx - 1 : 0); x <= tx + 1 && x < tw; x++)
+					changed[y * tw + x] = 1;
+		}
+	
+	if(!any)
+	{
+		memcpy(rbitmap, d->last, cells * crows * sizeof(avgbmp_t));
+		return(0);
+	}
+	
+	needed = 0;
+	for(r = 0; r < crows; r++)
+	{
+		need[r] = 0;
+		for(ty = r * scale / REDUCE_TILE; ty <= ((r + 1) * scale - 1) / REDUCE_TILE && ty < th; ty++)
+			for(tx = 0; tx < tw; tx++)
+				need[r] |= changed[ty * tw + tx];
+		
+		needed += need[r];
+	}
+	
+	i = fswc_reduce_jpeg_rows(d, src, rbitmap, scale, rows, mode, need);
+	if(i) return(i);
+	
+	if(needed * 4 > crows * REDUCE_BUSY) d->busy = REDUCE_HOLD;
+	
+	/* A cell's centre tile decides, so rows that were not decoded
+	 * are all taken from the last frame. */
+	for(r = 0; r < crows; r++)
+	{
+		ty = (r * scale + scale / 2) / REDUCE_TILE;
+		if(ty >= th) ty = th - 1;
+		
+		for(c = 0; c < cells; c++)
+		{
+			tx = (c * scale + scale / 2) / REDUCE_TILE;
+			if(tx >= tw) tx = tw - 1;
+			
+			t = r * cells + c;
+			if(changed[ty * tw + tx]) d->last[t] = rbitmap[t];
+			else rbitmap[t] = d->last[t];
+		}
+	}
+	
+	/* Tiles are only compared with what was last decoded, so slow
+	 * changes still add up. */
+	for(t = 0; t < tiles; t++)
+		if(changed[t]) ref[t] = cur[t];
+	
+	return(0);
+}
+
 int fswc_add_image_jpeg(src_t *src, avgbmp_t *abitmap)
 {
 	uint32_t x, y, hlength;
@@ -0,0 +1,174 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "filter.h"
+#include "log.h"
+
+int filter_init(filter_t *f, uint32_t words, uint32_t height, uint32_t width,
+                uint32_t open, uint32_t persist, uint32_t frames)
+{
+	memset(f, 0, sizeof(filter_t));
+
+	if(frames > FILTER_FRAMES) frames = FILTER_FRAMES;
+	if(persist > frames) persist = frames;
+
+	f->words   = words;
+	f->height  = height;
+	f->pad     = (width & 63 ? ~0ULL << (width & 63) : 0);
+	f->open    = open;
+	f->persist = persist;
+	f->frames  = (persist ? frames : 0);
+
+	f->scratch = malloc(words * height * sizeof(uint64_t));
+	if(!f->scratch)
+	{
+		ERROR("Out of memory.");
+		return(-1);
+	}
+
+	if(f->frames)
+	{
+		f->history = calloc(words * height * f->frames, sizeof(uint64_t));
+		if(!f->history)
+		{
+			ERROR("Out of memory.");
+			filter_free(f);
+			return(-1);
+		}
+	}
+
+	return(0);
+}
+
+void filter_free(filter_t *f)
+{
+	free(f->history);
+	free(f->scratch);
+	f->history = NULL;
+	f->scratch = NULL;
+}
+
+static void filter_step(uint64_t *dst, uint64_t *src, uint32_t words, int erode)
+{
+	/* Erodes or dilates a row by one cell either side. Beyond the
+	 * ends of the row counts as active for erosion only. */
+	uint64_t edge = (erode ? 1 : 0);
+	uint64_t l, r;
+	uint32_t i;
+
+	for(i = 0; i < words; i++)
+	{
+		l = (src[i] << 1) | (i ? src[i - 1] >> 63 : edge);
+		r = (src[i] >> 1) | ((i + 1 < words ? src[i + 1] & 1 : edge) << 63);
+
+		dst[i] = (erode ? src[i] & l & r : src[i] | l | r);
+	}
+}
+
+static void filter_spread(filter_t *f, uint64_t *a, uint32_t rows, int erode)
+{
+	/* One step of a 3x3 square, along the rows into the scratch
+	 * bitset and then down the columns back again. */
+	uint64_t *s = f->scratch, up, down;
+	uint32_t h, i, w = f->words;
+
+	for(h = 0; h < rows; h++)
+	{
+		filter_step(s + h * w, a + h * w, w, erode);
+
+		/* The padding stays set while eroding and clear while
+		 * dilating, so it never reaches a real column. */
+		if(erode) s[h * w + w - 1] |= f->pad;
+		else s[h * w + w - 1] &= ~f->pad;
+	}
+
+	for(h = 0; h < rows; h++)
+		for(i = 0; i < w; i++)
+		{
+			up   = (h > 0 ? s[(h - 1) * w + i] : (erode ? ~0ULL : 0));
+			down = (h + 1 < rows ? s[(h + 1) * w + i] : (erode ? ~0ULL : 0));
+
+			a[h * w + i] = (erode ? s[h * w + i] & up & down : s[h * w + i] | up | down);
+		}
+}
+
+static void filter_open(filter_t *f, uint64_t *a, uint32_t rows)
+{
+	uint32_t h, k;
+
+	for(h = 0; h < rows; h++) a[h * f->words + f->words - 1] |= f->pad;
+	for(k = 0; k < f->open; k++) filter_spread(f, a, rows, 1);
+
+	for(h = 0; h < rows; h++) a[h * f->words + f->words - 1] &= ~f->pad;
+	for(k = 0; k < f->open; k++) filter_spread(f, a, rows, 0);
+}
+
+static uint64_t filter_at_least(uint64_t *count, uint32_t n)
+{
+	/* Compares the 4-bit counts sliced across count[0..3] with n,
+	 * most significant bit first. */
+	uint64_t gt = 0, eq = ~0ULL;
+	int b;
+
+	for(b = 3; b >= 0; b--)
+	{
+		if((n >> b) & 1) eq &= count[b];
+		else
+		{
+			gt |= eq & count[b];
+			eq &= ~count[b];
+		}
+	}
+
+	return(gt | eq);
+}
+
+static void filter_persist(filter_t *f, uint64_t *a, uint32_t rows)
+{
+	/* Counts each cell over the last frames in four bit planes,
+	 * adding one frame at a time. */
+	uint32_t i, k, size = f->words * f->height;
+	uint64_t count[4], x, c;
+
+	memcpy(f->history + f->next * size, a, f->words * rows * sizeof(uint64_t));
+	f->next = (f->next + 1) % f->frames;
+
+	for(i = 0; i < f->words * rows; i++)
+	{
+		count[0] = count[1] = count[2] = count[3] = 0;
+
+		for(k = 0; k < f->frames; k++)
+		{
+			x = f->history[k * size + i];
+
+			c = count[0] & x; count[0] ^= x; x = c;
+			c = count[1] & x; count[1] ^= x; x = c;
+			c = count[2] & x; count[2] ^= x; x = c;
+			count[3] ^= x;
+		}
+
+		a[i] = filter_at_least(count, f->persist);
+	}
+}
+
+void filter_apply(filter_t *f, uint64_t *active, uint32_t rows)
+{
+	if(rows > f->height) rows = f->height;
+	if(!rows) return;
+
+	if(f->open) filter_open(f, active, rows);
+	if(f->frames) filter_persist(f, active, rows);
+}
+
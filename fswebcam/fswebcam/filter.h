@@ -0,0 +1,47 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_FILTER_H
+#define INC_FILTER_H
+
+#include <stdint.h>
+
+/* Filters for the bitset of cells over the threshold, working on 64
+ * cells at a time. Opening removes anything smaller than a square of
+ * 2 * open + 1 cells a side, and persistence keeps only the cells that
+ * were active in persist of the last frames frames. */
+#define FILTER_FRAMES (15)
+
+typedef struct {
+
+	uint32_t words;
+	uint32_t height;
+
+	/* Bits past the last column in the last word of each row. */
+	uint64_t pad;
+
+	uint32_t open;
+	uint32_t persist;
+	uint32_t frames;
+
+	/* The opened bitsets of the last frames frames, oldest at
+	 * next, and space for one more. */
+	uint64_t *history;
+	uint32_t next;
+	uint64_t *scratch;
+
+} filter_t;
+
+extern int filter_init(filter_t *f, uint32_t words, uint32_t height, uint32_t width,
+                       uint32_t open, uint32_t persist, uint32_t frames);
+extern void filter_free(filter_t *f);
+extern void filter_apply(filter_t *f, uint64_t *active, uint32_t rows);
+
+#endif
+
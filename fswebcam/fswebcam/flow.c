@@ -0,0 +1,248 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "flow.h"
+#include "src.h"
+#include "log.h"
+
+/* Eight cells at a time, as SSE2 or NEON registers. Cells are at most
+ * 255, so 128 rows of differences fit in each lane. */
+typedef int16_t flow_vec_t __attribute__ ((vector_size (16)));
+
+#define FLOW_LANES (sizeof(flow_vec_t) / sizeof(int16_t))
+#define FLOW_BATCH (128)
+
+/* Columns either side of each one in its block. */
+#define FLOW_BLOCK (1)
+
+int flow_init(flow_t *f, uint32_t width, uint32_t height, uint32_t budget)
+{
+	uint32_t i, size;
+
+	memset(f, 0, sizeof(flow_t));
+
+	f->width  = width;
+	f->height = height;
+	f->budget = budget;
+
+	/* Whole vectors can be read at any shift. */
+	f->stride = (width + FLOW_LANES - 1) / FLOW_LANES * FLOW_LANES + FLOW_RANGE * 2;
+	size = f->stride * height + FLOW_LANES;
+
+	f->curr  = malloc(size * sizeof(int16_t));
+	f->prev  = malloc(size * sizeof(int16_t));
+	f->sum   = malloc(width * sizeof(uint32_t));
+	f->shift = calloc(width, sizeof(int32_t));
+	if(!f->curr || !f->prev || !f->sum || !f->shift)
+	{
+		ERROR("Out of memory.");
+		flow_free(f);
+		return(-1);
+	}
+
+	for(i = 0; i < FLOW_SHIFTS; i++)
+	{
+		f->sad[i] = malloc(width * sizeof(uint32_t));
+		if(!f->sad[i])
+		{
+			ERROR("Out of memory.");
+			flow_free(f);
+			return(-1);
+		}
+	}
+
+	return(0);
+}
+
+void flow_free(flow_t *f)
+{
+	uint32_t i;
+
+	free(f->curr);
+	free(f->prev);
+	free(f->sum);
+	free(f->shift);
+	f->curr  = NULL;
+	f->prev  = NULL;
+	f->sum   = NULL;
+	f->shift = NULL;
+
+	for(i = 0; i < FLOW_SHIFTS; i++)
+	{
+		free(f->sad[i]);
+		f->sad[i] = NULL;
+	}
+}
+
+static void flow_copy(flow_t *f, avgbmp_t *curr, uint32_t rows)
+{
+	/* Copies the cells in, repeating the edge cells into the
+	 * padding so shifts past the edge see no change. */
+	uint32_t h, w;
+	int16_t *row;
+
+	for(h = 0; h < rows; h++)
+	{
+		row = f->curr + h * f->stride;
+
+		for(w = 0; w < f->width; w++)
+			row[FLOW_RANGE + w] = (curr[h * f->width + w] > 255 ? 255 : curr[h * f->width + w]);
+
+		for(w = 0; w < FLOW_RANGE; w++) row[w] = row[FLOW_RANGE];
+		for(w = FLOW_RANGE + f->width; w < f->stride; w++) row[w] = row[FLOW_RANGE + f->width - 1];
+	}
+}
+
+static inline flow_vec_t flow_load(int16_t *p)
+{
+	flow_vec_t v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return(v);
+}
+
+static void flow_columns(flow_t *f, int d, uint32_t rows)
+{
+	/* Sums each column's absolute difference from the previous
+	 * frame shifted d columns, over the rows. */
+	flow_vec_t a, b, s, acc;
+	uint32_t h, h0, w, l;
+	int16_t *curr, *prev;
+
+	memset(f->sum, 0, f->width * sizeof(uint32_t));
+
+	for(h0 = 0; h0 < rows; h0 += FLOW_BATCH)
+	{
+		for(w = 0; w < f->width; w += FLOW_LANES)
+		{
+			curr = f->curr + h0 * f->stride + FLOW_RANGE + w;
+			prev = f->prev + h0 * f->stride + FLOW_RANGE + w - d;
+			acc  = (flow_vec_t) { 0 };
+
+			for(h = h0; h < rows && h < h0 + FLOW_BATCH; h++)
+			{
+				a = flow_load(curr);
+				b = flow_load(prev);
+
+				a -= b;
+				s = a >> 15;
+				acc += (a ^ s) - s;
+
+				curr += f->stride;
+				prev += f->stride;
+			}
+
+			for(l = 0; l < FLOW_LANES && w + l < f->width; l++)
+				f->sum[w + l] += (uint16_t) acc[l];
+		}
+	}
+}
+
+static void flow_blocks(flow_t *f, uint32_t *sad)
+{
+	/* Adds up the columns of each block. */
+	uint32_t w, x, x0, x1;
+
+	for(w = 0; w < f->width; w++)
+	{
+		x0 = (w < FLOW_BLOCK ? 0 : w - FLOW_BLOCK);
+		x1 = (w + FLOW_BLOCK >= f->width ? f->width - 1 : w + FLOW_BLOCK);
+
+		sad[w] = 0;
+		for(x = x0; x <= x1; x++) sad[w] += f->sum[x];
+	}
+}
+
+static int32_t flow_fit(flow_t *f, uint32_t w, int d)
+{
+	/* The shift in columns * 256, between columns where the
+	 * neighbouring shifts were searched too. */
+	int64_t l, c, r, den;
+
+	c = f->sad[d + FLOW_RANGE][w];
+	if(d <= -FLOW_RANGE || d >= FLOW_RANGE ||
+	   !f->searched[d + FLOW_RANGE - 1] || !f->searched[d + FLOW_RANGE + 1])
+		return(d * 256);
+
+	l = f->sad[d + FLOW_RANGE - 1][w];
+	r = f->sad[d + FLOW_RANGE + 1][w];
+	den = l - 2 * c + r;
+	if(den <= 0) return(d * 256);
+
+	return(d * 256 + (l - r) * 128 / den);
+}
+
+void flow_update(flow_t *f, avgbmp_t *curr, uint32_t rows)
+{
+	uint64_t start = src_clock();
+	uint32_t w, best;
+	int16_t *t;
+	int k, d, bd;
+
+	if(rows > f->height) rows = f->height;
+
+	flow_copy(f, curr, rows);
+
+	memset(f->shift, 0, f->width * sizeof(int32_t));
+	memset(f->searched, 0, sizeof(f->searched));
+
+	if(!f->primed) f->primed = 1;
+	else
+	{
+		/* Smaller shifts first: 0, 1, -1, 2, -2... so running out
+		 * of time only narrows the search. */
+		for(k = 0; k < FLOW_SHIFTS; k++)
+		{
+			d = (k + 1) / 2 * (k & 1 ? 1 : -1);
+
+			if(k > 1 && f->budget && src_clock() - start > f->budget)
+			{
+				if(!f->overruns++)
+					WARN("Optical flow is over its time budget, searching fewer shifts.");
+				break;
+			}
+
+			flow_columns(f, d, rows);
+			flow_blocks(f, f->sad[d + FLOW_RANGE]);
+			f->searched[d + FLOW_RANGE] = 1;
+		}
+
+		for(w = 0; w < f->width; w++)
+		{
+			/* The best match must clearly beat standing still.
+			 * Ties go to the smaller shift. */
+			best = f->sad[FLOW_RANGE][w];
+			bd = 0;
+
+			for(k = 1; k < FLOW_SHIFTS; k++)
+			{
+				d = (k + 1) / 2 * (k & 1 ? 1 : -1);
+				if(!f->searched[d + FLOW_RANGE] || f->sad[d + FLOW_RANGE][w] >= best) continue;
+
+				best = f->sad[d + FLOW_RANGE][w];
+				bd = d;
+			}
+
+			if(bd && best * 4 < f->sad[FLOW_RANGE][w] * 3)
+				f->shift[w] = flow_fit(f, w, bd);
+		}
+	}
+
+	t = f->prev;
+	f->prev = f->curr;
+	f->curr = t;
+}
+
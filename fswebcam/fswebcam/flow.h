@@ -0,0 +1,55 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_FLOW_H
+#define INC_FLOW_H
+
+#include <stdint.h>
+#include "fswebcam.h"
+
+/* Horizontal motion of each column of cells, found by matching a
+ * block around the column against the previous frame shifted up to
+ * FLOW_RANGE columns either way. */
+#define FLOW_RANGE  (3)
+#define FLOW_SHIFTS (FLOW_RANGE * 2 + 1)
+
+typedef struct {
+
+	uint32_t width;
+	uint32_t height;
+
+	/* Cells of the current and previous frames, one row every
+	 * stride cells with FLOW_RANGE cells of padding either side. */
+	uint32_t stride;
+	int16_t *curr;
+	int16_t *prev;
+	char primed;
+
+	/* Block differences for each shift, and the shifts searched
+	 * in the last frame. */
+	uint32_t *sum;
+	uint32_t *sad[FLOW_SHIFTS];
+	char searched[FLOW_SHIFTS];
+
+	/* Give up on larger shifts after this many microseconds each
+	 * frame, or 0 to always search them all. */
+	uint32_t budget;
+	uint32_t overruns;
+
+	/* Motion of each column since the last frame, in columns * 256. */
+	int32_t *shift;
+
+} flow_t;
+
+extern int flow_init(flow_t *f, uint32_t width, uint32_t height, uint32_t budget);
+extern void flow_free(flow_t *f);
+extern void flow_update(flow_t *f, avgbmp_t *curr, uint32_t rows);
+
+#endif
+
@@ -29,6 +29,8 @@
 #include "dec.h"
 /* #include "effects.h" */
 #include "parse.h"
+#include "motion.h"
+#include "pipeline.h"
 
 typedef int bool;
 #define true 1
@@ -45,6 +47,12 @@ typedef int bool;
 #define FORMAT_JPEG (0)
 #define FORMAT_PNG  (1)
 
+/* Milliseconds between attempts to reopen a lost camera, doubling
+ * after each failure, and how often the wait is checked. */
+#define RECONNECT_MIN  (250)
+#define RECONNECT_MAX  (16000)
+#define RECONNECT_TICK (250)
+
 #define MODE_DEBUG
 
 enum fswc_options {
@@ -99,6 +107,29 @@ enum fswc_options {
 	OPT_EXEC,
 	OPT_DUMPFRAME,
 	OPT_FPS,
+	OPT_IDLE,
+	OPT_IDLE_SKIP,
+	OPT_IDLE_FPS,
+	OPT_THREADS,
+	OPT_BUFFERS,
+	OPT_LATEST,
+	OPT_FRAMED,
+	OPT_STATS,
+	OPT_CONTROL,
+	OPT_ROI,
+	OPT_CELL,
+	OPT_DC,
+	OPT_STRIPES,
+	OPT_MASK,
+	OPT_TRACK,
+	OPT_FLOW,
+	OPT_OPEN,
+	OPT_PERSIST,
+	OPT_AUTO_THRESHOLD,
+	OPT_NORMALIZE,
+	OPT_GLOBAL,
+	OPT_PYRAMID,
+	OPT_SPARSE,
 };
 
 typedef struct {
@@ -142,11 +173,17 @@ typedef struct {
 	unsigned long frequency;
 	unsigned long delay;
 	char use_read;
+	uint32_t buffers;
+	char latest;
 	uint8_t list;
 
 	/* Image capture options. */
 	int width;
 	int height;
+	uint32_t roi_x;
+	uint32_t roi_y;
+	uint32_t roi_width;
+	uint32_t roi_height;
 	unsigned int frames;
 	unsigned int fps;
 	unsigned int skipframes;
@@ -186,6 +223,57 @@ typedef struct {
 	uint32_t multiplier;
 	uint32_t lowerscan;
 
+	/* Measure each cell's noise over this many frames and raise its
+	 * threshold above it, or 0. */
+	uint32_t auto_threshold;
+
+	/* Pixels per side of each reduced cell, and how it is reduced. */
+	uint16_t cell;
+	char dc;
+
+	/* Image of the cells to ignore, or NULL. */
+	char *mask;
+
+	/* Ignore changes smaller than 2 * open + 1 cells a side, or
+	 * seen in fewer than persist of the last persist_frames. */
+	uint32_t open;
+	uint32_t persist;
+	uint32_t persist_frames;
+
+	/* Fit each frame's brightness to the next, and take frames with
+	 * this percentage of the cells changed as a change in the lighting,
+	 * or 0. */
+	char normalize;
+	uint32_t global;
+
+	/* Adaptive duty cycle. */
+	uint32_t idle;
+	uint32_t idle_skip;
+	uint32_t idle_fps;
+
+	/* Decode threads. */
+	unsigned int threads;
+	unsigned int stripes;
+
+	/* Decode only where tiles of the frame changed by more than this
+	 * many levels, or 0. */
+	uint32_t pyramid;
+
+	/* Write framed, timestamped motion records, and tracks or only
+	 * the active columns in place of every column. */
+	char framed;
+	char track;
+	char sparse;
+
+	/* Measure each column's horizontal motion, spending at most this
+	 * many microseconds a frame on it. */
+	char flow;
+	uint32_t flow_budget;
+
+	/* Statistics interval and control socket. */
+	uint32_t stats;
+	char *control;
+
 } fswebcam_config_t;
 
 
@@ -329,244 +417,492 @@ int fswc_exec(fswebcam_config_t *config, char *cmd)
 	return(0);
 }
 
-int fswc_grab(fswebcam_config_t *config)
-{
-	uint32_t frame;
-	uint32_t x, y, h, w, t;
-	avgbmp_t *abitmap, *pbitmap, *currBitMap, *prevBitMap, *baseBitMap;
-	avgbmp_t *p_currBitMap, *p_prevBitMap, *p_baseBitMap;
-	gdImage *image, *original;
-	uint8_t modified;
-	src_t src;
-
-	uint32_t curr, prev, currSum, prevSum;
-
+/* Lets a running capture reload the configuration. */
+typedef struct {
 
-	uint16_t scale = 10;
+	fswebcam_config_t *config;
+	int argc;
+	char **argv;
 
-	char buffer[71];
+	/* A reloaded configuration to set the capture up again with. */
+	fswebcam_config_t *next;
 
+} fswc_reload_t;
 
-	/* Record the start time. */
-	config->start = time(NULL);
+int fswc_getopts(fswebcam_config_t *config, int argc, char *argv[]);
+int fswc_free_config(fswebcam_config_t *config);
 
-	/* Set source options... */
-	memset(&src, 0, sizeof(src));
-	src.input      = config->input;
-	src.tuner      = config->tuner;
-	src.frequency  = config->frequency;
-	src.delay      = config->delay;
-	src.timeout    = 10; /* seconds */
-	src.use_read   = config->use_read;
-	src.list       = config->list;
-	src.palette    = config->palette;
-	src.width      = config->width;
-	src.height     = config->height;
-	src.fps        = config->fps;
-	src.option     = config->option;
+int fswc_strdiff(char *a, char *b)
+{
+	if(!a || !b) return(a != b);
+	return(strcmp(a, b) != 0);
+}
 
+int fswc_options_differ(src_option_t **a, src_option_t **b)
+{
+	char *value;
+	int n = 0;
 
-	#ifdef MODE_DEBUG
-		HEAD("--- Opening %s...", config->device);
-	#endif
+	if(a) for(; *a; a++, n++)
+	{
+		if(src_get_option_by_name(b, (*a)->name, &value)) return(1);
+		if(fswc_strdiff((*a)->value, value)) return(1);
+	}
 
-	if(src_open(&src, config->device) == -1) return(-1);
+	if(b) for(; *b; b++) n--;
 
-	/* The source may have adjusted the width and height we passed
-	 * to it. Update the main config to match. */
-	config->width  = src.width;
-	config->height = src.height;
+	return(n != 0);
+}
 
+int fswc_needs_reopen(fswebcam_config_t *a, fswebcam_config_t *b)
+{
+	/* Options only applied as the device is opened. */
+	return(fswc_strdiff(a->device, b->device) ||
+	       fswc_strdiff(a->input, b->input) ||
+	       a->tuner != b->tuner ||
+	       a->frequency != b->frequency ||
+	       a->use_read != b->use_read ||
+	       a->buffers != b->buffers ||
+	       a->latest != b->latest ||
+	       a->palette != b->palette ||
+	       a->width != b->width ||
+	       a->height != b->height ||
+	       a->fps != b->fps ||
+	       a->roi_x != b->roi_x ||
+	       a->roi_y != b->roi_y ||
+	       a->roi_width != b->roi_width ||
+	       a->roi_height != b->roi_height ||
+	       (a->threads > 1) != (b->threads > 1) ||
+	       fswc_options_differ(a->option, b->option));
+}
 
-	/* Allocate memory for the reduced bitmap buffer. */
-	//currBitMap = calloc((config->width / scale) * (config->height / scale), sizeof(avgbmp_t));
-	int reducedWidth = ((config->width / scale) + 1);
-	int reducedHeight = ((config->height / scale) + 1);
+int fswc_needs_restart(fswebcam_config_t *a, fswebcam_config_t *b)
+{
+	/* Options fixed for as long as the capture runs. */
+	return(a->cell != b->cell ||
+	       a->dc != b->dc ||
+	       a->threads != b->threads ||
+	       a->stripes != b->stripes ||
+	       a->pyramid != b->pyramid ||
+	       a->mode != b->mode ||
+	       a->framed != b->framed ||
+	       a->track != b->track ||
+	       a->sparse != b->sparse ||
+	       a->flow != b->flow ||
+	       a->flow_budget != b->flow_budget ||
+	       a->stats != b->stats ||
+	       fswc_strdiff(a->control, b->control) ||
+	       fswc_strdiff(a->mask, b->mask) ||
+	       a->auto_threshold != b->auto_threshold ||
+	       a->open != b->open ||
+	       a->persist != b->persist ||
+	       a->persist_frames != b->persist_frames ||
+	       a->normalize != b->normalize ||
+	       a->global != b->global ||
+	       fswc_needs_reopen(a, b));
+}
 
-	currBitMap = calloc( reducedWidth * reducedHeight, sizeof(avgbmp_t));
-	prevBitMap = calloc( reducedWidth * reducedHeight, sizeof(avgbmp_t));
-	baseBitMap = calloc( reducedWidth * reducedHeight, sizeof(avgbmp_t));
+void fswc_get_tune(fswebcam_config_t *config, fswc_tune_t *t)
+{
+	t->threshold  = config->threshold;
+	t->multiplier = config->multiplier;
+	t->lowerscan  = config->lowerscan;
+	t->idle       = config->idle;
+	t->idle_skip  = config->idle_skip;
+	t->idle_fps   = config->idle_fps;
+}
 
-	p_currBitMap = currBitMap;
-	p_prevBitMap = prevBitMap;
-	p_baseBitMap = baseBitMap;
+int fswc_reload(void *arg, char *name, char *value, fswc_tune_t *t)
+{
+	fswc_reload_t *rl = (fswc_reload_t *) arg;
+	fswebcam_config_t *config = rl->config;
+	fswebcam_config_t *next;
+	int v;
 
-	if(!currBitMap || !prevBitMap || !baseBitMap)
+	if(name)
 	{
-		ERROR("Out of memory.");
-		return(-1);
-	}
+		/* One option, as named on the command line. */
+		if(!strcmp(name, "mask"))
+		{
+			if(config->mask && !strcmp(config->mask, value))
+			{
+				fswc_get_tune(config, t);
+				return(0);
+			}
 
-// every frame
-// grab current frame
-// reduce current frame
+			/* The running capture borrows the current mask, so the
+			 * new one goes in the configuration that replaces it
+			 * once the capture has stopped. */
+			next = rl->next;
+			if(!next)
+			{
+				next = calloc(sizeof(fswebcam_config_t), 1);
+				if(!next)
+				{
+					ERROR("Out of memory.");
+					return(-1);
+				}
 
+				if(fswc_getopts(next, rl->argc, rl->argv))
+				{
+					fswc_free_config(next);
+					free(next);
+					return(-1);
+				}
 
-// scan from starting pixel...
-// compare to previous frame pixels
-// record total difference
+				/* Keep what was set while capturing. */
+				next->threshold  = config->threshold;
+				next->multiplier = config->multiplier;
+				next->lowerscan  = config->lowerscan;
+				next->idle       = config->idle;
+				next->idle_skip  = config->idle_skip;
+				next->idle_fps   = config->idle_fps;
+				next->cell       = config->cell;
+			}
 
-// if there is a current baseline\
-// compare to baseline - if there is a y difference greater than B-threshold
-// then
+			free(next->mask);
+			next->mask = strdup(value);
+			rl->next = next;
 
-// if total difference has remained less than T-threshold for 20 frames
-// then use this as a baseline
+			return(CAPTURE_RESTART);
+		}
 
+		v = atoi(value);
+		if(v < 0) return(-1);
 
-// determine whether pixels have changed beyond some threshold
+		if(!strcmp(name, "threshold"))       config->threshold  = v;
+		else if(!strcmp(name, "multiplier")) config->multiplier = v;
+		else if(!strcmp(name, "lowerscan"))  config->lowerscan  = v;
+		else if(!strcmp(name, "idle"))       config->idle       = v;
+		else if(!strcmp(name, "idle-skip"))  config->idle_skip  = (v < 1 ? 1 : v);
+		else if(!strcmp(name, "idle-fps"))   config->idle_fps   = v;
+		else if(!strcmp(name, "cell"))
+		{
+			if(v < 1 || (config->dc && v % 8)) return(-1);
+			if(v != config->cell)
+			{
+				config->cell = v;
+				return(CAPTURE_RESTART);
+			}
+		}
+		else return(-1);
 
-	bool debugout = false;
-	bool diffout = false;
+		fswc_get_tune(config, t);
 
-	if ( config->mode == 'x' ) {
-		debugout = true;
+		return(0);
 	}
-	if ( config->mode == 'z' ) {
-		debugout = true;
-		diffout = true;
+
+	/* Read the command line and configuration files again. */
+	next = calloc(sizeof(fswebcam_config_t), 1);
+	if(!next)
+	{
+		ERROR("Out of memory.");
+		return(-1);
 	}
 
-//	for(frame = 0; frame < config->frames; frame++)
-	while ( 1 == 1 )
+	if(fswc_getopts(next, rl->argc, rl->argv))
 	{
+		WARN("Keeping the current configuration.");
+		fswc_free_config(next);
+		free(next);
+		return(-1);
+	}
 
-		if(received_sigterm)
+	if(fswc_needs_restart(config, next))
+	{
+		/* The running capture still uses the current one. */
+		if(rl->next)
 		{
-			MSG("Received TERM signal... exiting.");
-			break;
+			fswc_free_config(rl->next);
+			free(rl->next);
 		}
 
-		// copy currBitMap to prevBitMap
+		rl->next = next;
 
-		prevBitMap = p_prevBitMap;
-		currBitMap = p_currBitMap;
+		return(CAPTURE_RESTART);
+	}
 
-		int maxCurr = 0;
-		int maxPrev = 0;
-		int diffSum = 0;
+	/* Nothing else in the configuration affects the capture. */
+	config->threshold  = next->threshold;
+	config->multiplier = next->multiplier;
+	config->lowerscan  = next->lowerscan;
+	config->idle       = next->idle;
+	config->idle_skip  = next->idle_skip;
+	config->idle_fps   = next->idle_fps;
 
-		for ( t=0; t < reducedWidth * reducedHeight; t++ ){
-			*(p_prevBitMap + t) = *(p_currBitMap + t);
-		}
+	fswc_free_config(next);
+	free(next);
+
+	fswc_get_tune(config, t);
+
+	return(0);
+}
+
+int fswc_open(fswebcam_config_t *config, src_t *src)
+{
+	/* Set source options... */
+	memset(src, 0, sizeof(src_t));
+	src->input      = config->input;
+	src->tuner      = config->tuner;
+	src->frequency  = config->frequency;
+	src->delay      = config->delay;
+	src->timeout    = 10; /* seconds */
+	src->use_read   = config->use_read;
+	src->buffers    = config->buffers;
+	src->latest     = config->latest;
+	src->list       = config->list;
+	src->palette    = config->palette;
+	src->width      = config->width;
+	src->height     = config->height;
+	src->roi_x      = config->roi_x;
+	src->roi_y      = config->roi_y;
+	src->roi_width  = config->roi_width;
+	src->roi_height = config->roi_height;
+	src->fps        = config->fps;
+	src->option     = config->option;
+	src->hold       = (config->threads > 1);
 
-		if(src_grab(&src) == -1) break;
 
-		reduce_img(&src, currBitMap, scale);
+	#ifdef MODE_DEBUG
+		HEAD("--- Opening %s...", config->device);
+	#endif
 
-		currSum = 0;
-		prevSum = 0;
+	if(src_open(src, config->device) == -1) return(-1);
 
-		if ( debugout ) {
-			printf("\033[%d;%dH", 0, 0);
+	/* Clip a region of interest still to be cropped by the decoder. */
+	if(src->roi_width)
+	{
+		if(src->roi_x >= src->width || src->roi_y >= src->height)
+		{
+			ERROR("The region of interest is outside the %ix%i frame.",
+			   src->width, src->height);
+			src_close(src);
+			return(-1);
 		}
 
-		for ( t=0; t < 71; t++ ){ buffer[t] = 0; }
+		if(src->roi_width > src->width - src->roi_x)
+			src->roi_width = src->width - src->roi_x;
+		if(src->roi_height > src->height - src->roi_y)
+			src->roi_height = src->height - src->roi_y;
 
-		int cutoff = config->lowerscan;
+		MSG("Decoding %ix%i at %i,%i.",
+		   src->roi_width, src->roi_height, src->roi_x, src->roi_y);
+	}
 
-		for ( h=0; h < ( reducedHeight - cutoff ); h++ ){
+	return(0);
+}
 
-			for ( w=0; w < reducedWidth; w++ ){
+int fswc_run(fswebcam_config_t *config, src_t *src, fswc_reload_t *rl)
+{
+	motion_t motion;
+	fswc_capture_t capture;
+	int r;
 
-				curr = *(currBitMap++);
-				prev = *(prevBitMap++);
+	uint16_t scale = config->cell;
 
-				currSum += curr;
-				prevSum += prev;
+	/* One reduced cell per scale x scale block, including the
+	 * partial blocks at the right and bottom edges. */
+	if(motion_init(&motion,
+	   ((src->roi_width ? src->roi_width : src->width) + scale - 1) / scale,
+	   ((src->roi_width ? src->roi_height : src->height) + scale - 1) / scale))
+		return(-1);
 
-				int diff = ( abs(curr - prev) * config->multiplier );
-				diffSum += diff;
+	/* A mask that does not exist yet is written by calibrating. */
+	if(config->mask && access(config->mask, F_OK))
+		MSG("No mask at %s yet.", config->mask);
+	else if(config->mask && motion_load_mask(&motion, config->mask))
+	{
+		motion_free(&motion);
+		return(-1);
+	}
 
-				if ( diff > config->threshold ) {
-					if ( h > 253 ) { h = 253; }
-					if ( diff > 253 ) { diff = 253; }
+	motion.threshold  = config->threshold;
+	motion.multiplier = config->multiplier;
+	motion.lowerscan  = config->lowerscan;
+
+	if ( config->mode == 'x' ) motion.output = MOTION_OUT_CURR;
+	if ( config->mode == 'z' ) motion.output = MOTION_OUT_DIFF;
+	motion.framed = config->framed;
+
+	if((config->auto_threshold && motion_auto_threshold(&motion, config->auto_threshold)) ||
+	   ((config->open || config->persist_frames) &&
+	    motion_filter(&motion, config->open, config->persist, config->persist_frames)) ||
+	   (config->track && motion_track(&motion)) ||
+	   (config->sparse && motion_sparse(&motion)) ||
+	   (config->flow && motion_flow(&motion, config->flow_budget)) ||
+	   ((config->normalize || config->global) &&
+	    motion_light(&motion, config->normalize, config->global)))
+	{
+		motion_free(&motion);
+		return(-1);
+	}
 
-					buffer[w*2] = h;
-					buffer[(w*2) + 1] = diff;
-				}
+	memset(&capture, 0, sizeof(capture));
+	capture.src        = src;
+	capture.motion     = &motion;
+	capture.scale      = scale;
+	capture.reduce     = (config->dc ? REDUCE_DC : REDUCE_PIXELS);
+	capture.threads    = config->threads;
+	capture.stripes    = config->stripes;
+	capture.pyramid    = config->pyramid;
+	capture.fps        = config->fps;
+	capture.idle       = config->idle;
+	capture.idle_skip  = config->idle_skip;
+	capture.idle_fps   = config->idle_fps;
+	capture.stats      = config->stats;
+	capture.control    = config->control;
+	capture.mask       = config->mask;
+	capture.stop       = &received_sigterm;
+	capture.report     = &received_sigusr1;
+	capture.reload     = fswc_reload;
+	capture.reload_arg = rl;
+
+	r = fswc_capture(&capture);
+
+	motion_free(&motion);
 
-				if ( debugout ) {
-					if ( diffout ) {
-						print_graphic( diff );
-					} else {
-						print_graphic( curr );
-					}
-				}
-			}
+	return(r);
+}
 
-			if ( debugout ) {
-				printf("\n",0);
-			}
+int fswc_reconnect(fswebcam_config_t *config, src_t *src)
+{
+	/* Reopens the camera, waiting longer after each failed attempt.
+	 * Framed output gets a status frame about once a second in the
+	 * meantime. Returns -1 if told to exit first. */
+	uint32_t attempts = 0;
+	uint32_t wait = RECONNECT_MIN;
+	uint32_t t;
+
+	while(!received_sigterm)
+	{
+		for(t = 0; t < wait && !received_sigterm; t += RECONNECT_TICK)
+		{
+			if(config->framed && !(t % 1000))
+				motion_status(MOTION_STATUS_DEGRADED, attempts);
+			usleep(RECONNECT_TICK * 1000);
 		}
 
-		buffer[70] = 254;
+		if(received_sigterm) break;
 
-		if ( debugout ) {
-			printf("\033[%d;%dH", 10, 40);
-			printf("diffSum/lower- %d %d", diffSum / (reducedWidth * ( reducedHeight - cutoff )), config->lowerscan );
-		} else {
-			if( fwrite(buffer, 1, 71, stdout) != 71 ) {
-			    perror("fwrite");
-			};
-			fflush( stdout );
+		attempts++;
+		if(!fswc_open(config, src))
+		{
+			MSG("Camera back after %u attempts.", attempts);
+			if(config->framed) motion_status(MOTION_STATUS_OK, attempts);
+			return(0);
 		}
-	}
 
-	/* We are now finished with the capture card. */
-	src_close(&src);
+		wait *= 2;
+		if(wait > RECONNECT_MAX) wait = RECONNECT_MAX;
+	}
 
-	free(p_currBitMap);
-	free(p_prevBitMap);
-	free(p_baseBitMap);
+	MSG("Received TERM signal... exiting.");
 
-	return(0);
+	return(-1);
 }
 
+int fswc_grab(fswebcam_config_t *config, int argc, char *argv[])
+{
+	fswc_reload_t rl;
+	src_t src;
+	char reopen, open;
+	int r;
 
+	/* Record the start time. */
+	config->start = time(NULL);
 
+	if(fswc_open(config, &src)) return(-1);
+	open = 1;
 
-int reduce_img(src_t *src, avgbmp_t *rbitmap, uint16_t scale )
-{
-  uint32_t x, y, xs, ys, hlength;
-	uint8_t *himg = NULL;
-  uint8_t rv, gv, bv;
-	gdImage *im;
-	int i;
+	rl.config = config;
+	rl.argc   = argc;
+	rl.argv   = argv;
+	rl.next   = NULL;
+
+	while(1)
+	{
+		r = fswc_run(config, &src, &rl);
+
+		if(r == CAPTURE_RESTART)
+		{
+			/* The device stays open while the capture is set up
+			 * again, unless the new configuration changes how it
+			 * was opened. */
+			reopen = 0;
 
-	/* MJPEG data may lack the DHT segment required for decoding... */
-	i = verify_jpeg_dht(src->img, src->length, &himg, &hlength);
+			if(rl.next)
+			{
+				reopen = fswc_needs_reopen(config, rl.next);
 
-	im = gdImageCreateFromJpegPtr(hlength, himg);
-	if(i == 1) free(himg);
+				fswc_free_config(config);
+				*config = *rl.next;
+				free(rl.next);
+				rl.next = NULL;
 
-	if(!im) return(-1);
+				/* The source still points into the old one. */
+				src.input  = config->input;
+				src.option = config->option;
+			}
 
-  for( y = 0; y < src->height; y += scale ) {
-    for (x = 0; x < src->width; x += scale ) {
-      int val = 0;
-      int avgVal = 0;
+			if(!reopen) continue;
 
-      for ( ys = 0; ys < scale; ys++ ) {
-        for ( xs = 0; xs < scale; xs++ ) {
-          int c = gdImageGetPixel(im, x+xs, y+ys);
+			MSG("Reopening %s...", config->device);
+			src_close(&src);
+			open = 0;
 
-          rv = (c & 0xFF0000) >> 16;
-          gv = (c & 0x00FF00) >> 8;
-          bv = (c & 0x0000FF);
+			if(!fswc_open(config, &src))
+			{
+				open = 1;
+				continue;
+			}
+		}
+		else if(r == CAPTURE_LOST)
+		{
+			WARN("Lost the camera. Reconnecting...");
+			src_close(&src);
+			open = 0;
+		}
+		else break;
 
-          val += (( rv + gv + bv ) / 3 );
-        }
-      }
+		/* Output stays open for the consumer while we wait. */
+		if(fswc_reconnect(config, &src))
+		{
+			r = 0;
+			break;
+		}
 
-      avgVal = val / ( scale * scale );
+		open = 1;
+	}
 
-      *(rbitmap++) = avgVal;
-    }
-  }
-	gdImageDestroy(im);
+	if(rl.next)
+	{
+		fswc_free_config(rl.next);
+		free(rl.next);
+	}
 
-  return(0);
+	/* We are now finished with the capture card. */
+	if(open) src_close(&src);
+
+	return(r);
+}
+
+
+
+
+int reduce_img(fswc_decoder_t *d, src_t *src, avgbmp_t *rbitmap, uint16_t scale, uint32_t rows, int mode)
+{
+	/* Average each scale x scale block of the frame into one cell,
+	 * filling the first rows of cells. Pixels outside the frame count
+	 * as black. Only JPEG frames are supported. */
+	return(fswc_reduce_jpeg(d, src, rbitmap, scale, rows, mode));
+}
+
+int reduce_img_gated(fswc_decoder_t *d, src_t *src, avgbmp_t *rbitmap, uint16_t scale, uint32_t rows, int mode, uint32_t gate)
+{
+	/* As reduce_img(), but only where tiles of the frame changed by
+	 * more than gate since the decoder last saw them. Each decoder
+	 * compares frames with the ones it reduced itself. */
+	return(fswc_reduce_jpeg_gated(d, src, rbitmap, scale, rows, mode, gate));
 }
 
 
@@ -768,6 +1104,26 @@ int fswc_usage()
 				 " -N, --threshold              Threshold for difference.\n"
 				 " -M, --multiplier             Multiplier for difference.\n"
 				 " -B, --lowerscan              Lower Scan Limit.\n"
+			 "     --auto-threshold <frames> Raise each cell's threshold above its noise.\n"
+			 "     --cell <pixels>          Size of each detection cell. (Default 10)\n"
+			 "     --dc                     Detect on JPEG DC terms only. (Cell of 8n)\n"
+			 "     --mask <filename>        PGM or PNG image of the cells to ignore.\n"
+			 "     --open <cells>           Ignore changes smaller than 2n+1 cells a side.\n"
+			 "     --persist <n>/<frames>   Ignore cells changed in fewer than n frames.\n"
+			 "     --normalize              Compensate for changes in the lighting.\n"
+			 "     --global <percent>       Report frames with this much changed as lighting.\n"
+			 "     --idle <frames>          Go idle after this many frames without motion.\n"
+			 "     --idle-skip <number>     Decode one frame in this many while idle.\n"
+			 "     --idle-fps <framerate>   Capture frame rate while idle.\n"
+			 "     --threads <number>       Decode frames on this many threads.\n"
+			 "     --stripes <number>       Split frames at restart markers to decode.\n"
+			 "     --pyramid <levels>       Decode only where 32 pixel tiles changed.\n"
+			 "     --framed                 Write framed records with timestamps.\n"
+			 "     --track                  Write tracked blobs in place of columns.\n"
+			 "     --sparse                 Write only the active columns, when they change.\n"
+			 "     --flow <microseconds>    Add column velocities, within a time budget.\n"
+			 "     --stats <seconds>        Log capture statistics at this interval.\n"
+			 "     --control <path>         Accept commands on this Unix socket.\n"
 	       " -c, --config <filename>      Load configuration from file.\n"
 	       " -q, --quiet                  Hides all messages except for errors.\n"
 	       " -v, --verbose                Displays extra messages while capturing\n"
@@ -788,12 +1144,15 @@ int fswc_usage()
 	       " -D, --delay <number>         Sets the pre-capture delay time. (seconds)\n"
 	       " -r, --resolution <size>      Sets the capture resolution.\n"
 	       "     --fps <framerate>        Sets the capture frame rate.\n"
+	       "     --roi <size>[,<offset>]  Only decode this part of each frame.\n"
 	       "     --list-framesizes        Displays the available frame sizes.\n"
 	       "     --list-framerates        Displays the available frame rates.\n"
 	       " -F, --frames <number>        Sets the number of frames to capture.\n"
 	       " -S, --skip <number>          Sets the number of frames to skip.\n"
 	       "     --dumpframe <filename>   Dump a raw frame to file.\n"
 	       " -R, --read                   Use read() to capture images.\n"
+	       "     --buffers <number>       Sets the number of capture buffers.\n"
+	       "     --latest                 Skip to the newest frame on each grab.\n"
 	       "     --list-formats           Displays the available capture formats.\n"
 	       " -s, --set <name>=<value>     Sets a control value.\n"
 	       "     --list-controls          Displays the available controls.\n"
@@ -1014,6 +1373,26 @@ int fswc_getopts(fswebcam_config_t *config, int argc, char *argv[])
 		{"threshold",       required_argument, 0, 'N'},
 		{"multiplier",      required_argument, 0, 'M'},
 		{"lowerscan",       required_argument, 0, 'B'},
+		{"auto-threshold",  required_argument, 0, OPT_AUTO_THRESHOLD},
+		{"cell",            required_argument, 0, OPT_CELL},
+		{"dc",              no_argument,       0, OPT_DC},
+		{"mask",            required_argument, 0, OPT_MASK},
+		{"open",            required_argument, 0, OPT_OPEN},
+		{"persist",         required_argument, 0, OPT_PERSIST},
+		{"normalize",       no_argument,       0, OPT_NORMALIZE},
+		{"global",          required_argument, 0, OPT_GLOBAL},
+		{"idle",            required_argument, 0, OPT_IDLE},
+		{"idle-skip",       required_argument, 0, OPT_IDLE_SKIP},
+		{"idle-fps",        required_argument, 0, OPT_IDLE_FPS},
+		{"threads",         required_argument, 0, OPT_THREADS},
+		{"stripes",         required_argument, 0, OPT_STRIPES},
+		{"pyramid",         required_argument, 0, OPT_PYRAMID},
+		{"framed",          no_argument,       0, OPT_FRAMED},
+		{"track",           no_argument,       0, OPT_TRACK},
+		{"sparse",          no_argument,       0, OPT_SPARSE},
+		{"flow",            required_argument, 0, OPT_FLOW},
+		{"stats",           required_argument, 0, OPT_STATS},
+		{"control",         required_argument, 0, OPT_CONTROL},
 		{"debug-diff",      no_argument,       0, 'Z'},
 		{"debug-curr",      no_argument,       0, 'X'},
 		{"help",            no_argument,       0, '?'},
@@ -1035,6 +1414,9 @@ int fswc_getopts(fswebcam_config_t *config, int argc, char *argv[])
 		{"delay",           required_argument, 0, 'D'},
 		{"resolution",      required_argument, 0, 'r'},
 		{"fps",	            required_argument, 0, OPT_FPS},
+		{"roi",             required_argument, 0, OPT_ROI},
+		{"buffers",         required_argument, 0, OPT_BUFFERS},
+		{"latest",          no_argument,       0, OPT_LATEST},
 		{"list-framesizes", no_argument,       0, OPT_LIST_FRAMESIZES},
 		{"list-framerates", no_argument,       0, OPT_LIST_FRAMERATES},
 		{"frames",          required_argument, 0, 'F'},
@@ -1105,9 +1487,15 @@ int fswc_getopts(fswebcam_config_t *config, int argc, char *argv[])
 	config->frequency = 0;
 	config->delay = 0;
 	config->use_read = 0;
+	config->buffers = 0;
+	config->latest = 0;
 	config->list = 0;
 	config->width = 384;
 	config->height = 288;
+	config->roi_x = 0;
+	config->roi_y = 0;
+	config->roi_width = 0;
+	config->roi_height = 0;
 	config->fps = 0;
 	config->frames = 1;
 	config->skipframes = 0;
@@ -1119,7 +1507,29 @@ int fswc_getopts(fswebcam_config_t *config, int argc, char *argv[])
 	config->mode = 'c';
 	config->threshold = 10;
 	config->multiplier = 1;
+	config->auto_threshold = 0;
 	config->lowerscan = 0;
+	config->cell = 10;
+	config->dc = 0;
+	config->mask = NULL;
+	config->open = 0;
+	config->persist = 0;
+	config->persist_frames = 0;
+	config->normalize = 0;
+	config->global = 0;
+	config->idle = 0;
+	config->idle_skip = 4;
+	config->idle_fps = 0;
+	config->threads = 1;
+	config->stripes = 0;
+	config->pyramid = 0;
+	config->framed = 0;
+	config->track = 0;
+	config->sparse = 0;
+	config->flow = 0;
+	config->flow_budget = 0;
+	config->stats = 0;
+	config->control = NULL;
 
 	/* Don't report errors. */
 	opterr = 0;
@@ -1130,8 +1540,6 @@ int fswc_getopts(fswebcam_config_t *config, int argc, char *argv[])
 	/* Parse the command line and any config files. */
 	while((c = fswc_getopt(&s, argc, argv)) != -1)
 	{
-		printf("lowerscan - first%c", c);
-		//exit(0);
 		switch(c)
 		{
 		case '?': fswc_usage(); /* Command line error. */
@@ -1148,6 +1556,76 @@ int fswc_getopts(fswebcam_config_t *config, int argc, char *argv[])
 		case 'B':
 			config->lowerscan = atoi(optarg);
 			break;
+		case OPT_AUTO_THRESHOLD:
+			config->auto_threshold = atoi(optarg);
+			break;
+		case OPT_CELL:
+			config->cell = atoi(optarg);
+			break;
+		case OPT_DC:
+			config->dc = 1;
+			break;
+		case OPT_IDLE:
+			config->idle = atoi(optarg);
+			break;
+		case OPT_IDLE_SKIP:
+			config->idle_skip = atoi(optarg);
+			break;
+		case OPT_IDLE_FPS:
+			config->idle_fps = atoi(optarg);
+			break;
+		case OPT_THREADS:
+			config->threads = atoi(optarg);
+			break;
+		case OPT_STRIPES:
+			config->stripes = atoi(optarg);
+			break;
+		case OPT_PYRAMID:
+			config->pyramid = atoi(optarg);
+			break;
+		case OPT_FRAMED:
+			config->framed = 1;
+			break;
+		case OPT_TRACK:
+			/* Tracks only come in frames. */
+			config->track = 1;
+			config->framed = 1;
+			break;
+		case OPT_SPARSE:
+			/* So do sparse columns. */
+			config->sparse = 1;
+			config->framed = 1;
+			break;
+		case OPT_FLOW:
+			/* Velocities only come in frames. 0 for no budget. */
+			config->flow = 1;
+			config->flow_budget = atoi(optarg);
+			config->framed = 1;
+			break;
+		case OPT_STATS:
+			config->stats = atoi(optarg);
+			break;
+		case OPT_CONTROL:
+			if(config->control) free(config->control);
+			config->control = strdup(optarg);
+			break;
+		case OPT_MASK:
+			if(config->mask) free(config->mask);
+			config->mask = strdup(optarg);
+			break;
+		case OPT_OPEN:
+			config->open = atoi(optarg);
+			break;
+		case OPT_PERSIST:
+			config->persist        = argtol(optarg, "/", 0, 0, 10);
+			config->persist_frames = argtol(optarg, "/", 1, 0, 10);
+			break;
+		case OPT_NORMALIZE:
+			config->normalize = 1;
+			break;
+		case OPT_GLOBAL:
+			config->global = atoi(optarg);
+			break;
 
 
 		case 'c':
@@ -1220,9 +1698,24 @@ int fswc_getopts(fswebcam_config_t *config, int argc, char *argv[])
 		case OPT_FPS:
 			config->fps = atoi(optarg);
 			break;
+		case OPT_ROI:
+			config->roi_width  = argtol(optarg, "x, ", 0, 0, 10);
+			config->roi_height = argtol(optarg, "x, ", 1, 0, 10);
+			config->roi_x = config->roi_y = 0;
+			if(argcount(optarg, "x, ", 0) >= 4)
+			{
+				config->roi_x = argtol(optarg, "x, ", 2, 0, 10);
+				config->roi_y = argtol(optarg, "x, ", 3, 0, 10);
+			}
+			break;
+		case OPT_BUFFERS:
+			config->buffers = atoi(optarg);
+			break;
+		case OPT_LATEST:
+			config->latest = 1;
+			break;
 		case 'F':
 			config->frames = atoi(optarg);
-			printf("frames - %d", config->frames );
 			break;
 		case 'S':
 			config->skipframes = atoi(optarg);
@@ -1261,7 +1754,42 @@ int fswc_getopts(fswebcam_config_t *config, int argc, char *argv[])
 	if(config->frequency < 0)       config->frequency = 0;
 	if(config->width < 1)           config->width = 1;
 	if(config->height < 1)          config->height = 1;
+	if(config->roi_height < 1)      config->roi_width = 0;
+	if(config->cell < 1)            config->cell = 1;
+	if(config->persist_frames > FILTER_FRAMES)
+	{
+		WARN("Persistence can cover at most %u frames.", FILTER_FRAMES);
+		config->persist_frames = FILTER_FRAMES;
+	}
+	if(config->persist > config->persist_frames) config->persist = config->persist_frames;
+	if(!config->persist) config->persist_frames = 0;
+	if(config->global > 100)        config->global = 100;
+	if(config->dc && config->cell % 8)
+	{
+		WARN("DC detection needs a cell size that is a multiple of 8.");
+		config->cell = (config->cell + 7) & ~7;
+		WARN("Using %u.", config->cell);
+	}
 	if(config->frames < 1)          config->frames = 1;
+	if(config->idle_skip < 1)       config->idle_skip = 1;
+	if(config->threads < 1)         config->threads = 1;
+	if(config->threads > PIPE_MAX_WORKERS)
+	{
+		WARN("Requested %u threads, maximum is %u. Using that.",
+		   config->threads, PIPE_MAX_WORKERS);
+		config->threads = PIPE_MAX_WORKERS;
+	}
+	if(config->stripes > STRIPE_MAX + 1)
+	{
+		WARN("Requested %u stripes, maximum is %u. Using that.",
+		   config->stripes, STRIPE_MAX + 1);
+		config->stripes = STRIPE_MAX + 1;
+	}
+	if(config->pyramid && config->stripes)
+	{
+		WARN("Striped frames are always decoded whole, ignoring --pyramid.");
+		config->pyramid = 0;
+	}
 	if(config->frames > MAX_FRAMES)
 	{
 		WARN("Requested %u frames, maximum is %u. Using that.",
@@ -1296,6 +1824,8 @@ int fswc_free_config(fswebcam_config_t *config)
 	free(config->underlay);
 	free(config->overlay);
 	free(config->filename);
+	free(config->control);
+	free(config->mask);
 
 	src_free_options(&config->option);
 	fswc_free_jobs(config);
@@ -1339,7 +1869,7 @@ int main(int argc, char *argv[])
 	if(!gdFTUseFontConfig(1)) DEBUG("gd has no fontconfig support");
 
 	/* Capture the image(s). */
-	if(!config->loop) fswc_grab(config);
+	if(!config->loop) fswc_grab(config, argc, argv);
 	else
 	{
 		/* Loop mode ... keep capturing images until terminated. */
@@ -1396,7 +1926,7 @@ int main(int argc, char *argv[])
 			received_sigusr1 = 0;
 
 			/* Capture the image. */
-			fswc_grab(config);
+			fswc_grab(config, argc, argv);
 		}
 	}
 
@@ -33,7 +33,27 @@ typedef uint16_t avgbmp_t;
 
 #define CLIP(val, min, max) (((val) > (max)) ? (max) : (((val) < (min)) ? (min) : (val)))
 
-extern int reduce_img(src_t *src, avgbmp_t *rbitmap, uint16_t scale);
+/* How reduce_img() finds the value of each cell. */
+#define REDUCE_PIXELS (0) /* Mean of (r+g+b)/3 over the decoded pixels */
+#define REDUCE_DC     (1) /* Mean luma from the JPEG DC terms alone */
+
+/* Gated reduction compares tiles of REDUCE_TILE pixels a side, and
+ * only decodes cells near any that changed. */
+#define REDUCE_TILE (32)
+
+/* A JPEG decoder reused from frame to frame. Each thread needs its own. */
+typedef struct fswc_decoder fswc_decoder_t;
+
+extern fswc_decoder_t *fswc_decoder_new(void);
+extern void fswc_decoder_free(fswc_decoder_t *d);
+extern uint8_t *fswc_decoder_scratch(fswc_decoder_t *d, uint32_t size);
+
+extern uint32_t fswc_jpeg_dht(uint8_t *src, uint32_t lsrc, uint32_t *at, uint8_t **seg);
+extern int verify_jpeg_dht(uint8_t *src, uint32_t lsrc, uint8_t **dst, uint32_t *ldst);
+extern int reduce_img(fswc_decoder_t *d, src_t *src, avgbmp_t *rbitmap, uint16_t scale, uint32_t rows, int mode);
+extern int fswc_reduce_jpeg(fswc_decoder_t *d, src_t *src, avgbmp_t *rbitmap, uint16_t scale, uint32_t rows, int mode);
+extern int reduce_img_gated(fswc_decoder_t *d, src_t *src, avgbmp_t *rbitmap, uint16_t scale, uint32_t rows, int mode, uint32_t gate);
+extern int fswc_reduce_jpeg_gated(fswc_decoder_t *d, src_t *src, avgbmp_t *rbitmap, uint16_t scale, uint32_t rows, int mode, uint32_t gate);
 extern int print_aligned( int input );
 extern int print_graphic( int input );
 
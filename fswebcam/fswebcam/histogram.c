@@ -0,0 +1,114 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include "histogram.h"
+#include "log.h"
+
+#define BUCKETS (HISTOGRAM_SUB * HISTOGRAM_RANGES)
+
+static uint32_t histogram_bucket(uint64_t value)
+{
+	uint64_t base;
+	uint32_t range;
+
+	if(value < HISTOGRAM_SUB) return(value);
+
+	/* HISTOGRAM_SUB is 2^3. */
+	range = (63 - __builtin_clzll(value)) - 3 + 1;
+	if(range >= HISTOGRAM_RANGES) return(BUCKETS - 1);
+
+	base = (uint64_t) HISTOGRAM_SUB << (range - 1);
+
+	return(range * HISTOGRAM_SUB + (value - base) / (base / HISTOGRAM_SUB));
+}
+
+static uint64_t histogram_top(uint32_t i)
+{
+	uint32_t range = i / HISTOGRAM_SUB;
+	uint64_t base;
+
+	if(!range) return(i + 1);
+
+	base = (uint64_t) HISTOGRAM_SUB << (range - 1);
+
+	return(base + (i % HISTOGRAM_SUB + 1) * (base / HISTOGRAM_SUB));
+}
+
+void histogram_init(histogram_t *h, char *name)
+{
+	h->name = name;
+	histogram_reset(h);
+}
+
+void histogram_reset(histogram_t *h)
+{
+	memset(h->bucket, 0, sizeof(h->bucket));
+	h->count = 0;
+	h->sum   = 0;
+	h->min   = UINT64_MAX;
+	h->max   = 0;
+}
+
+void histogram_record(histogram_t *h, uint64_t value)
+{
+	h->bucket[histogram_bucket(value)]++;
+	h->count++;
+	h->sum += value;
+	if(value < h->min) h->min = value;
+	if(value > h->max) h->max = value;
+}
+
+uint64_t histogram_percentile(histogram_t *h, double p)
+{
+	/* Returns the upper edge of the bucket holding the p'th
+	 * percentile (0 - 100), or the largest value if lower. */
+	uint64_t rank, seen = 0;
+	uint32_t i;
+
+	if(!h->count) return(0);
+
+	rank = (uint64_t) (h->count * p / 100);
+	if(rank < h->count * p / 100) rank++;
+
+	for(i = 0; i < BUCKETS; i++)
+	{
+		seen += h->bucket[i];
+		if(seen >= rank)
+		{
+			uint64_t top = histogram_top(i);
+			return(top < h->max ? top : h->max);
+		}
+	}
+
+	return(h->max);
+}
+
+void histogram_report(histogram_t *h)
+{
+	if(!h->count)
+	{
+		MSG("%s: no samples", h->name);
+		return;
+	}
+
+	MSG("%s: n=%u min=%llu mean=%llu p50=%llu p90=%llu p99=%llu max=%llu us",
+	    h->name, h->count,
+	    (unsigned long long) h->min,
+	    (unsigned long long) (h->sum / h->count),
+	    (unsigned long long) histogram_percentile(h, 50),
+	    (unsigned long long) histogram_percentile(h, 90),
+	    (unsigned long long) histogram_percentile(h, 99),
+	    (unsigned long long) h->max);
+}
+
@@ -0,0 +1,40 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_HISTOGRAM_H
+#define INC_HISTOGRAM_H
+
+#include <stdint.h>
+
+/* Log-linear histogram for timings in microseconds. Each power of two
+ * is split into HISTOGRAM_SUB linear buckets, the same layout as
+ * histogram.js in the light engine, so reports compare directly. */
+#define HISTOGRAM_SUB    (8)
+#define HISTOGRAM_RANGES (32)
+
+typedef struct {
+
+	char *name;
+
+	uint32_t bucket[HISTOGRAM_SUB * HISTOGRAM_RANGES];
+	uint32_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+
+} histogram_t;
+
+extern void histogram_init(histogram_t *h, char *name);
+extern void histogram_reset(histogram_t *h);
+extern void histogram_record(histogram_t *h, uint64_t value);
+extern uint64_t histogram_percentile(histogram_t *h, double p);
+extern void histogram_report(histogram_t *h);
+
+#endif
+
@@ -0,0 +1,108 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "light.h"
+
+/* Below this spread between the quartiles the gain cannot be
+ * measured, and only the offset is fitted. */
+#define LIGHT_SPREAD (8)
+
+int light_init(light_t *l, char normalize, uint32_t percent)
+{
+	memset(l, 0, sizeof(light_t));
+
+	l->normalize = normalize;
+	l->percent   = (percent > 100 ? 100 : percent);
+	l->gain      = 256;
+
+	return(0);
+}
+
+void light_free(light_t *l)
+{
+	memset(l, 0, sizeof(light_t));
+}
+
+static void light_quartiles(avgbmp_t *cells, uint32_t n, int32_t *q)
+{
+	/* The first, second and third quartile of the cells. */
+	uint32_t hist[256];
+	uint32_t i, v, sum, k;
+
+	memset(hist, 0, sizeof(hist));
+	for(i = 0; i < n; i++)
+	{
+		v = cells[i];
+		hist[v > 255 ? 255 : v]++;
+	}
+
+	sum = 0;
+	k = 0;
+	for(v = 0; v < 256 && k < 3; v++)
+	{
+		sum += hist[v];
+		while(k < 3 && sum * 4 > n * (k + 1)) q[k++] = v;
+	}
+
+	while(k < 3) q[k++] = 255;
+}
+
+void light_normalize(light_t *l, avgbmp_t *curr, avgbmp_t *prev, uint32_t cells)
+{
+	int32_t qc[3], qp[3], v;
+	uint32_t i;
+
+	l->gain   = 256;
+	l->offset = 0;
+
+	if(!l->normalize || !cells) return;
+
+	light_quartiles(curr, cells, qc);
+	light_quartiles(prev, cells, qp);
+
+	/* Most frames see no change in the lighting. */
+	for(i = 0; i < 3; i++)
+		if(abs(qc[i] - qp[i]) > LIGHT_SLACK) break;
+	if(i == 3) return;
+
+	if(qp[2] - qp[0] >= LIGHT_SPREAD && qc[2] - qc[0] >= LIGHT_SPREAD)
+	{
+		l->gain = ((qc[2] - qc[0]) << 8) / (qp[2] - qp[0]);
+		if(l->gain < LIGHT_GAIN_MIN) l->gain = LIGHT_GAIN_MIN;
+		if(l->gain > LIGHT_GAIN_MAX) l->gain = LIGHT_GAIN_MAX;
+	}
+
+	l->offset = qc[1] - ((qp[1] * l->gain + 128) >> 8);
+
+	for(i = 0; i < cells; i++)
+	{
+		v = (((int32_t) prev[i] * l->gain + 128) >> 8) + l->offset;
+		prev[i] = (v < 0 ? 0 : v > 255 ? 255 : v);
+	}
+}
+
+int light_global(light_t *l, uint64_t *active, uint32_t words, uint32_t width, uint32_t rows)
+{
+	uint32_t i, count = 0;
+
+	for(i = 0; i < words * rows; i++)
+		count += __builtin_popcountll(active[i]);
+
+	l->changed = (width && rows ? count * 100 / (width * rows) : 0);
+	l->event   = (l->percent && l->changed >= l->percent);
+
+	return(l->event);
+}
+
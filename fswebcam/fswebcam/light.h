@@ -0,0 +1,53 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_LIGHT_H
+#define INC_LIGHT_H
+
+#include <stdint.h>
+#include "fswebcam.h"
+
+/* Changes in the lighting. The previous frame is brought to the
+ * brightness of the current one with a gain and offset fitted to the
+ * quartiles of both, so a whole scene getting brighter or darker does
+ * not show as motion. Quartiles that moved by no more than LIGHT_SLACK
+ * levels are taken as unchanged. */
+#define LIGHT_SLACK    (2)
+#define LIGHT_GAIN_MIN (128) /* * 256 */
+#define LIGHT_GAIN_MAX (1024)
+
+typedef struct {
+
+	/* Fit the previous frame to the current one. */
+	char normalize;
+
+	/* With this percentage of the cells active, the frame is taken
+	 * as a change in the lighting rather than motion, or 0. */
+	uint32_t percent;
+
+	/* Results for the last frame. The gain is * 256. */
+	int32_t gain;
+	int32_t offset;
+	uint32_t changed;
+	char event;
+
+} light_t;
+
+extern int light_init(light_t *l, char normalize, uint32_t percent);
+extern void light_free(light_t *l);
+
+/* Rewrites prev to match the brightness of curr. */
+extern void light_normalize(light_t *l, avgbmp_t *curr, avgbmp_t *prev, uint32_t cells);
+
+/* Counts the active cells and decides if the frame is a lighting
+ * event. Returns 1 if it is. */
+extern int light_global(light_t *l, uint64_t *active, uint32_t words, uint32_t width, uint32_t rows);
+
+#endif
+
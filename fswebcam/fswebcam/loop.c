@@ -0,0 +1,227 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "loop.h"
+#include "log.h"
+
+#define LOOP_EVENTS (16)
+
+int loop_init(fswc_loop_t *l)
+{
+	memset(l, 0, sizeof(fswc_loop_t));
+
+	l->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(l->epfd == -1)
+	{
+		ERROR("epoll_create1: %s", strerror(errno));
+		return(-1);
+	}
+
+	return(0);
+}
+
+static void loop_sweep(fswc_loop_t *l)
+{
+	/* Free the watches removed since the last pass. */
+	fswc_watch_t **p = &l->watch;
+	fswc_watch_t *w;
+
+	while(*p)
+	{
+		w = *p;
+		if(w->fn)
+		{
+			p = &w->next;
+			continue;
+		}
+
+		*p = w->next;
+		free(w);
+	}
+}
+
+void loop_free(fswc_loop_t *l)
+{
+	fswc_watch_t *w;
+
+	for(w = l->watch; w; w = w->next) loop_unwatch(l, w);
+	loop_sweep(l);
+
+	if(l->epfd >= 0) close(l->epfd);
+	l->epfd = -1;
+}
+
+fswc_watch_t *loop_watch(fswc_loop_t *l, int fd, uint32_t events, fswc_handler_t fn, void *arg)
+{
+	struct epoll_event ev;
+	fswc_watch_t *w;
+
+	w = calloc(1, sizeof(fswc_watch_t));
+	if(!w)
+	{
+		ERROR("Out of memory.");
+		return(NULL);
+	}
+
+	w->fd     = fd;
+	w->events = events;
+	w->fn     = fn;
+	w->arg    = arg;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events   = events;
+	ev.data.ptr = w;
+
+	if(epoll_ctl(l->epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+	{
+		ERROR("epoll_ctl: %s", strerror(errno));
+		free(w);
+		return(NULL);
+	}
+
+	w->next  = l->watch;
+	l->watch = w;
+
+	return(w);
+}
+
+int loop_modify(fswc_loop_t *l, fswc_watch_t *w, uint32_t events)
+{
+	struct epoll_event ev;
+
+	if(w->events == events) return(0);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events   = events;
+	ev.data.ptr = w;
+
+	if(epoll_ctl(l->epfd, EPOLL_CTL_MOD, w->fd, &ev) == -1)
+	{
+		ERROR("epoll_ctl: %s", strerror(errno));
+		return(-1);
+	}
+
+	w->events = events;
+
+	return(0);
+}
+
+void loop_unwatch(fswc_loop_t *l, fswc_watch_t *w)
+{
+	/* The watch itself is freed after the current pass, as
+	 * events for it may still be waiting to be dispatched. */
+	if(!w->fn) return;
+
+	epoll_ctl(l->epfd, EPOLL_CTL_DEL, w->fd, NULL);
+	if(w->owned) close(w->fd);
+
+	w->fn = NULL;
+}
+
+fswc_watch_t *loop_timer(fswc_loop_t *l, uint32_t ms, fswc_handler_t fn, void *arg)
+{
+	struct itimerspec its;
+	fswc_watch_t *w;
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(fd == -1)
+	{
+		ERROR("timerfd_create: %s", strerror(errno));
+		return(NULL);
+	}
+
+	memset(&its, 0, sizeof(its));
+	its.it_interval.tv_sec  = ms / 1000;
+	its.it_interval.tv_nsec = (ms % 1000) * 1000000;
+	its.it_value = its.it_interval;
+
+	if(timerfd_settime(fd, 0, &its, NULL) == -1)
+	{
+		ERROR("timerfd_settime: %s", strerror(errno));
+		close(fd);
+		return(NULL);
+	}
+
+	w = loop_watch(l, fd, EPOLLIN, fn, arg);
+	if(!w)
+	{
+		close(fd);
+		return(NULL);
+	}
+
+	w->owned = 1;
+
+	return(w);
+}
+
+uint64_t loop_expirations(fswc_watch_t *w)
+{
+	/* Acknowledge a timer, returning how often it has fired. */
+	uint64_t n;
+
+	if(read(w->fd, &n, sizeof(n)) != sizeof(n)) return(0);
+
+	return(n);
+}
+
+int loop_run(fswc_loop_t *l)
+{
+	struct epoll_event ev[LOOP_EVENTS];
+	fswc_watch_t *w;
+	int i, n, r = 0;
+
+	l->quit = 0;
+
+	while(!l->quit)
+	{
+		n = epoll_wait(l->epfd, ev, LOOP_EVENTS, (l->poll ? 0 : -1));
+		if(n == -1)
+		{
+			if(errno == EINTR) continue;
+
+			ERROR("epoll_wait: %s", strerror(errno));
+			r = -1;
+			break;
+		}
+
+		for(i = 0; i < n && !l->quit; i++)
+		{
+			w = (fswc_watch_t *) ev[i].data.ptr;
+			if(!w->fn) continue;
+
+			if(w->fn(w->arg, ev[i].events) < 0)
+			{
+				r = -1;
+				l->quit = 1;
+			}
+		}
+
+		loop_sweep(l);
+
+		if(l->poll && !l->quit && l->poll(l->poll_arg, 0) < 0)
+		{
+			r = -1;
+			l->quit = 1;
+		}
+	}
+
+	return(r);
+}
+
@@ -0,0 +1,58 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_LOOP_H
+#define INC_LOOP_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+/* Handlers are called with the epoll events that fired. Returning
+ * -1 ends loop_run() with an error. */
+typedef int (*fswc_handler_t)(void *arg, uint32_t events);
+
+typedef struct fswc_watch {
+
+	int fd;
+	uint32_t events;
+	fswc_handler_t fn;
+	void *arg;
+
+	/* Close the descriptor when the watch is removed. */
+	char owned;
+
+	struct fswc_watch *next;
+
+} fswc_watch_t;
+
+typedef struct {
+
+	int epfd;
+	char quit;
+
+	fswc_watch_t *watch;
+
+	/* If set, called on every pass without waiting, for
+	 * sources that have no descriptor to wait on. */
+	fswc_handler_t poll;
+	void *poll_arg;
+
+} fswc_loop_t;
+
+extern int loop_init(fswc_loop_t *l);
+extern void loop_free(fswc_loop_t *l);
+extern fswc_watch_t *loop_watch(fswc_loop_t *l, int fd, uint32_t events, fswc_handler_t fn, void *arg);
+extern int loop_modify(fswc_loop_t *l, fswc_watch_t *w, uint32_t events);
+extern void loop_unwatch(fswc_loop_t *l, fswc_watch_t *w);
+extern fswc_watch_t *loop_timer(fswc_loop_t *l, uint32_t ms, fswc_handler_t fn, void *arg);
+extern uint64_t loop_expirations(fswc_watch_t *w);
+extern int loop_run(fswc_loop_t *l);
+
+#endif
+
@@ -0,0 +1,960 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <gd.h>
+#include "fswebcam.h"
+#include "motion.h"
+#include "log.h"
+
+int motion_init(motion_t *m, uint32_t width, uint32_t height)
+{
+	memset(m, 0, sizeof(motion_t));
+
+	m->width  = width;
+	m->height = height;
+
+	m->words = (width + 63) / 64;
+
+	m->prev   = calloc(width * height, sizeof(avgbmp_t));
+	m->mask   = malloc(width * height * sizeof(uint32_t));
+	m->diff   = malloc(width * height * sizeof(int));
+	m->active = malloc(m->words * height * sizeof(uint64_t));
+	if(!m->prev || !m->mask || !m->diff || !m->active)
+	{
+		ERROR("Out of memory.");
+		motion_free(m);
+		return(-1);
+	}
+
+	/* Nothing is masked to begin with. */
+	memset(m->mask, 0xFF, width * height * sizeof(uint32_t));
+
+	return(0);
+}
+
+void motion_free(motion_t *m)
+{
+	free(m->prev);
+	free(m->mask);
+	free(m->hits);
+	free(m->diff);
+	free(m->active);
+	m->prev   = NULL;
+	m->mask   = NULL;
+	m->hits   = NULL;
+	m->diff   = NULL;
+	m->active = NULL;
+
+	if(m->filter)
+	{
+		filter_free(m->filter);
+		free(m->filter);
+		m->filter = NULL;
+	}
+
+	if(m->tracker)
+	{
+		tracker_free(m->tracker);
+		free(m->tracker);
+		m->tracker = NULL;
+	}
+
+	if(m->flow)
+	{
+		flow_free(m->flow);
+		free(m->flow);
+		m->flow = NULL;
+	}
+
+	if(m->noise)
+	{
+		noise_free(m->noise);
+		free(m->noise);
+		m->noise = NULL;
+	}
+
+	if(m->light)
+	{
+		light_free(m->light);
+		free(m->light);
+		m->light = NULL;
+	}
+
+	free(m->sparse);
+	m->sparse      = NULL;
+	m->sparse_last = NULL;
+}
+
+int motion_auto_threshold(motion_t *m, uint32_t frames)
+{
+	/* Raise each cell's threshold above its own noise. */
+	m->noise = malloc(sizeof(noise_t));
+	if(!m->noise)
+	{
+		ERROR("Out of memory.");
+		return(-1);
+	}
+
+	if(noise_init(m->noise, m->width, m->height, frames))
+	{
+		free(m->noise);
+		m->noise = NULL;
+		return(-1);
+	}
+
+	return(0);
+}
+
+int motion_flow(motion_t *m, uint32_t budget)
+{
+	/* Add each column's horizontal velocity to the column frames. */
+	m->flow = malloc(sizeof(flow_t));
+	if(!m->flow)
+	{
+		ERROR("Out of memory.");
+		return(-1);
+	}
+
+	if(flow_init(m->flow, m->width, m->height, budget))
+	{
+		free(m->flow);
+		m->flow = NULL;
+		return(-1);
+	}
+
+	return(0);
+}
+
+int motion_light(motion_t *m, char normalize, uint32_t percent)
+{
+	/* Compensate for and report changes in the lighting. */
+	m->light = malloc(sizeof(light_t));
+	if(!m->light)
+	{
+		ERROR("Out of memory.");
+		return(-1);
+	}
+
+	if(light_init(m->light, normalize, percent))
+	{
+		free(m->light);
+		m->light = NULL;
+		return(-1);
+	}
+
+	return(0);
+}
+
+int motion_sparse(motion_t *m)
+{
+	/* Write only the active columns, and nothing while they stay
+	 * the same. A frame of every column and its last entries. */
+	size_t size = m->width * MOTION_SPARSE_FLOW;
+
+	m->sparse = malloc(MOTION_HEADER + MOTION_SPARSE_HEAD + size * 2);
+	if(!m->sparse)
+	{
+		ERROR("Out of memory.");
+		return(-1);
+	}
+
+	m->sparse_last   = m->sparse + MOTION_HEADER + MOTION_SPARSE_HEAD + size;
+	m->sparse_length = 0;
+	m->sparse_at     = 0;
+
+	return(0);
+}
+
+int motion_track(motion_t *m)
+{
+	/* Follow blobs of changed cells rather than reporting columns. */
+	m->tracker = malloc(sizeof(tracker_t));
+	if(!m->tracker)
+	{
+		ERROR("Out of memory.");
+		return(-1);
+	}
+
+	if(tracker_init(m->tracker, m->width, m->height))
+	{
+		free(m->tracker);
+		m->tracker = NULL;
+		return(-1);
+	}
+
+	return(0);
+}
+
+int motion_filter(motion_t *m, uint32_t open, uint32_t persist, uint32_t frames)
+{
+	/* Clean up the cells over the threshold before they are used. */
+	m->filter = malloc(sizeof(filter_t));
+	if(!m->filter)
+	{
+		ERROR("Out of memory.");
+		return(-1);
+	}
+
+	if(filter_init(m->filter, m->words, m->height, m->width, open, persist, frames))
+	{
+		free(m->filter);
+		m->filter = NULL;
+		return(-1);
+	}
+
+	return(0);
+}
+
+uint32_t motion_rows(motion_t *m)
+{
+	/* Rows of cells above the lowerscan limit. */
+	return(m->lowerscan < m->height ? m->height - m->lowerscan : 0);
+}
+
+int motion_detect(motion_t *m, avgbmp_t *curr)
+{
+	/* Compares a reduced frame against the previous one and fills
+	 * in the output record. The frame then becomes the previous one.
+	 * Returns 1 if any cell changed by more than the threshold. */
+	uint32_t h, w, t, i, limit;
+	uint32_t rows = motion_rows(m);
+	uint64_t *row, bits;
+	int triggered = 0;
+
+	memset(m->record, 0, MOTION_RECORD);
+	m->diffsum = 0;
+
+	memset(m->active, 0, m->words * rows * sizeof(uint64_t));
+
+	/* The first frame has nothing to be compared with. */
+	if(!m->primed)
+	{
+		m->record[MOTION_RECORD - 1] = MOTION_DELIMITER;
+		memcpy(m->prev, curr, m->width * m->height * sizeof(avgbmp_t));
+		m->primed = 1;
+
+		if(m->flow) flow_update(m->flow, curr, rows);
+		return(0);
+	}
+
+	if(m->light) light_normalize(m->light, curr, m->prev, m->width * rows);
+
+	if(m->output != MOTION_OUT_RECORD) printf("\033[%d;%dH", 0, 0);
+
+	for(h = 0; h < rows; h++)
+	{
+		for(w = 0; w < m->width; w++)
+		{
+			t = h * m->width + w;
+
+			int diff = (abs((int) curr[t] - (int) m->prev[t]) * m->multiplier) & m->mask[t];
+			m->diffsum += diff;
+			m->diff[t] = diff;
+
+			/* The threshold is the least any cell needs. */
+			limit = m->threshold;
+			if(m->noise && m->noise->limit[t] * m->multiplier > limit)
+				limit = m->noise->limit[t] * m->multiplier;
+
+			if(diff > limit)
+			{
+				m->active[h * m->words + (w >> 6)] |= 1ULL << (w & 63);
+				if(m->hits) m->hits[t]++;
+			}
+
+			if(m->output == MOTION_OUT_DIFF) print_graphic(diff);
+			else if(m->output == MOTION_OUT_CURR) print_graphic(curr[t]);
+		}
+
+		if(m->output != MOTION_OUT_RECORD) printf("\n");
+	}
+
+	if(m->filter) filter_apply(m->filter, m->active, rows);
+
+	/* Too much changed for it to be anything but the lighting. None
+	 * of it is reported, and none of it is taken as noise. */
+	if(m->light && light_global(m->light, m->active, m->words, m->width, rows))
+	{
+		memset(m->active, 0, m->words * rows * sizeof(uint64_t));
+		m->record[MOTION_RECORD - 1] = MOTION_DELIMITER;
+
+		if(m->flow) flow_update(m->flow, curr, rows);
+		memcpy(m->prev, curr, m->width * m->height * sizeof(avgbmp_t));
+
+		return(0);
+	}
+
+	/* Each column reports the lowest active cell. Columns past the
+	 * end of the record still count, but cannot be reported. */
+	for(h = 0; h < rows; h++)
+	{
+		row = m->active + h * m->words;
+
+		for(i = 0; i < m->words; i++)
+			for(bits = row[i]; bits; bits &= bits - 1)
+			{
+				triggered = 1;
+
+				w = (i << 6) + __builtin_ctzll(bits);
+				if(w >= MOTION_COLUMNS) break;
+
+				t = h * m->width + w;
+				m->record[w * 2]     = (h > 253 ? 253 : h);
+				m->record[w * 2 + 1] = (m->diff[t] > 253 ? 253 : m->diff[t]);
+			}
+	}
+
+	m->record[MOTION_RECORD - 1] = MOTION_DELIMITER;
+
+	if(m->flow) flow_update(m->flow, curr, rows);
+	if(m->noise) noise_update(m->noise, curr, m->prev, m->active, m->words, rows);
+
+	memcpy(m->prev, curr, m->width * m->height * sizeof(avgbmp_t));
+
+	return(triggered);
+}
+
+static uint8_t *motion_put(uint8_t *p, uint64_t v, int bytes)
+{
+	while(bytes--)
+	{
+		*(p++) = v & 0xFF;
+		v >>= 8;
+	}
+
+	return(p);
+}
+
+static int motion_output_tracks(motion_t *m, uint32_t seq, uint64_t captured)
+{
+	uint8_t frame[MOTION_HEADER + 23 + TRACK_MAX * MOTION_TRACK_SIZE];
+	uint32_t i, n;
+	track_t *tr;
+	uint8_t *p;
+	size_t length;
+
+	n = tracker_update(m->tracker, m->active, m->diff, motion_rows(m), captured);
+
+	length = 23 + n * MOTION_TRACK_SIZE;
+
+	p = frame;
+	*(p++) = MOTION_SYNC;
+	*(p++) = MOTION_FRAME_TRACKS;
+	p = motion_put(p, length, 2);
+	p = motion_put(p, seq, 4);
+	p = motion_put(p, captured, 8);
+	p = motion_put(p, src_clock(), 8);
+	p = motion_put(p, m->width, 2);
+	*(p++) = n;
+
+	for(i = 0; i < n; i++)
+	{
+		tr = &m->tracker->track[i];
+
+		p = motion_put(p, tr->id, 2);
+		p = motion_put(p, tr->centroid, 2);
+		*(p++) = (tr->left   > 255 ? 255 : tr->left);
+		*(p++) = (tr->right  > 255 ? 255 : tr->right);
+		*(p++) = (tr->top    > 255 ? 255 : tr->top);
+		*(p++) = (tr->bottom > 255 ? 255 : tr->bottom);
+		p = motion_put(p, (tr->velocity > 32767 ? 32767 :
+		                   tr->velocity < -32768 ? -32768 : tr->velocity), 2);
+		p = motion_put(p, (tr->age > 0xFFFF ? 0xFFFF : tr->age), 2);
+		p = motion_put(p, (tr->cells > 0xFFFF ? 0xFFFF : tr->cells), 2);
+	}
+
+	length += MOTION_HEADER;
+	if(fwrite(frame, 1, length, stdout) != length)
+	{
+		ERROR("Error writing the tracks frame.");
+		return(-1);
+	}
+
+	fflush(stdout);
+
+	return(0);
+}
+
+static int motion_output_global(motion_t *m, uint32_t seq, uint64_t captured)
+{
+	uint8_t frame[MOTION_HEADER + 25];
+	uint8_t *p = frame;
+
+	*(p++) = MOTION_SYNC;
+	*(p++) = MOTION_FRAME_GLOBAL;
+	p = motion_put(p, sizeof(frame) - MOTION_HEADER, 2);
+	p = motion_put(p, seq, 4);
+	p = motion_put(p, captured, 8);
+	p = motion_put(p, src_clock(), 8);
+	*(p++) = m->light->changed;
+	p = motion_put(p, m->light->gain, 2);
+	p = motion_put(p, (uint16_t) m->light->offset, 2);
+
+	if(fwrite(frame, 1, sizeof(frame), stdout) != sizeof(frame))
+	{
+		ERROR("Error writing the global frame.");
+		return(-1);
+	}
+
+	fflush(stdout);
+
+	return(0);
+}
+
+static int64_t motion_velocity(motion_t *m, uint32_t w, uint64_t captured)
+{
+	/* A column's velocity, from its shift since the last frame. */
+	int64_t v = 0;
+
+	if(w < m->width && m->flow_at && captured > m->flow_at)
+		v = (int64_t) m->flow->shift[w] * 1000000 / (int64_t) (captured - m->flow_at);
+
+	return(v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+}
+
+static uint8_t *motion_put_flow(motion_t *m, uint8_t *p, uint64_t captured)
+{
+	uint32_t w;
+
+	for(w = 0; w < MOTION_COLUMNS; w++)
+		p = motion_put(p, motion_velocity(m, w, captured), 2);
+
+	m->flow_at = captured;
+
+	return(p);
+}
+
+static int motion_output_sparse(motion_t *m, uint32_t seq, uint64_t captured)
+{
+	/* Each active column's lowest active cell, as the record has
+	 * it but for every column. Lower rows are found first, so each
+	 * column keeps the first row it is seen in. */
+	uint32_t rows = motion_rows(m);
+	uint32_t lowest[64];
+	uint32_t i, w, t, n, size, max;
+	uint64_t seen, found, bits, now;
+	int32_t h;
+	uint8_t *p, *entries;
+	size_t length;
+
+	size = (m->flow ? MOTION_SPARSE_FLOW : MOTION_SPARSE_ENTRY);
+	max  = (0xFFFF - MOTION_SPARSE_HEAD) / size;
+	entries = p = m->sparse + MOTION_HEADER + MOTION_SPARSE_HEAD;
+	n = 0;
+
+	for(i = 0; i < m->words; i++)
+	{
+		seen = 0;
+		for(h = rows - 1; h >= 0; h--)
+		{
+			found = m->active[h * m->words + i] & ~seen;
+			for(bits = found; bits; bits &= bits - 1)
+				lowest[__builtin_ctzll(bits)] = h;
+			seen |= found;
+		}
+
+		for(bits = seen; bits && n < max; bits &= bits - 1, n++)
+		{
+			w = (i << 6) + __builtin_ctzll(bits);
+			t = lowest[w & 63] * m->width + w;
+
+			p = motion_put(p, w, 2);
+			*(p++) = (lowest[w & 63] > 255 ? 255 : lowest[w & 63]);
+			*(p++) = (m->diff[t] > 255 ? 255 : m->diff[t]);
+			if(m->flow) p = motion_put(p, motion_velocity(m, w, captured), 2);
+		}
+	}
+
+	if(m->flow) m->flow_at = captured;
+
+	length = p - entries;
+	now = src_clock();
+
+	if(length == m->sparse_length && !memcmp(entries, m->sparse_last, length))
+	{
+		/* Nothing to say but that the detector is still running. */
+		if(now - m->sparse_at < MOTION_HEARTBEAT) return(0);
+
+		length = 20;
+
+		p = m->sparse;
+		*(p++) = MOTION_SYNC;
+		*(p++) = MOTION_FRAME_HEARTBEAT;
+		p = motion_put(p, length, 2);
+		p = motion_put(p, seq, 4);
+		p = motion_put(p, captured, 8);
+		p = motion_put(p, now, 8);
+	}
+	else
+	{
+		memcpy(m->sparse_last, entries, length);
+		m->sparse_length = length;
+
+		length += MOTION_SPARSE_HEAD;
+
+		p = m->sparse;
+		*(p++) = MOTION_SYNC;
+		*(p++) = MOTION_FRAME_SPARSE;
+		p = motion_put(p, length, 2);
+		p = motion_put(p, seq, 4);
+		p = motion_put(p, captured, 8);
+		p = motion_put(p, now, 8);
+		p = motion_put(p, m->width, 2);
+		p = motion_put(p, n, 2);
+		*(p++) = size;
+	}
+
+	m->sparse_at = now;
+
+	length += MOTION_HEADER;
+	if(fwrite(m->sparse, 1, length, stdout) != length)
+	{
+		ERROR("Error writing the sparse frame.");
+		return(-1);
+	}
+
+	fflush(stdout);
+
+	return(0);
+}
+
+int motion_output(motion_t *m, uint32_t seq, uint64_t captured)
+{
+	uint8_t frame[MOTION_HEADER + 20 + MOTION_COLUMNS * 4];
+	uint8_t *p;
+	size_t length;
+
+	uint32_t rows = motion_rows(m);
+
+	if(m->output != MOTION_OUT_RECORD)
+	{
+		printf("\033[%d;%dH", 10, 40);
+		printf("diffSum/lower- %d %d",
+		   (rows ? m->diffsum / (int) (m->width * rows) : 0), m->lowerscan);
+		fflush(stdout);
+		return(0);
+	}
+
+	if(m->framed && m->light && m->light->event)
+	{
+		/* The reader clears its columns, so the next sparse frame
+		 * must be written whatever it holds. */
+		m->sparse_length = (size_t) -1;
+		return(motion_output_global(m, seq, captured));
+	}
+
+	if(m->tracker) return(motion_output_tracks(m, seq, captured));
+	if(m->sparse) return(motion_output_sparse(m, seq, captured));
+
+	if(m->framed)
+	{
+		length = 20 + MOTION_COLUMNS * (m->flow ? 4 : 2);
+
+		p = frame;
+		*(p++) = MOTION_SYNC;
+		*(p++) = MOTION_FRAME_COLUMNS;
+		p = motion_put(p, length, 2);
+		p = motion_put(p, seq, 4);
+		p = motion_put(p, captured, 8);
+		p = motion_put(p, src_clock(), 8);
+		memcpy(p, m->record, MOTION_COLUMNS * 2);
+		p += MOTION_COLUMNS * 2;
+
+		if(m->flow) motion_put_flow(m, p, captured);
+
+		length += MOTION_HEADER;
+		if(fwrite(frame, 1, length, stdout) != length)
+		{
+			ERROR("Error writing the motion frame.");
+			return(-1);
+		}
+	}
+	else if(fwrite(m->record, 1, MOTION_RECORD, stdout) != MOTION_RECORD)
+	{
+		ERROR("Error writing the motion record.");
+		return(-1);
+	}
+
+	fflush(stdout);
+
+	return(0);
+}
+
+int motion_status(uint8_t status, uint32_t attempts)
+{
+	uint8_t frame[MOTION_HEADER + 13];
+	uint8_t *p = frame;
+
+	*(p++) = MOTION_SYNC;
+	*(p++) = MOTION_FRAME_STATUS;
+	p = motion_put(p, sizeof(frame) - MOTION_HEADER, 2);
+	*(p++) = status;
+	p = motion_put(p, attempts, 4);
+	p = motion_put(p, src_clock(), 8);
+
+	if(fwrite(frame, 1, sizeof(frame), stdout) != sizeof(frame))
+	{
+		ERROR("Error writing the status frame.");
+		return(-1);
+	}
+
+	fflush(stdout);
+
+	return(0);
+}
+
+
+static uint32_t motion_mask_value(int v)
+{
+	/* White keeps every bit and black none. Each step of 8 below
+	 * white clears one more low bit, ignoring smaller changes. */
+	if(v <= 0) return(0);
+	if(v >= 255) return(~0U);
+	return(~0U << ((255 - v) >> 3));
+}
+
+static int motion_mask_grey(uint32_t mask)
+{
+	int shift = 0;
+
+	if(!mask) return(0);
+	while(!(mask & 1))
+	{
+		mask >>= 1;
+		shift++;
+	}
+
+	return(255 - (shift << 3));
+}
+
+static uint8_t *motion_read_file(char *filename, size_t *length)
+{
+	uint8_t *data = NULL, *n;
+	size_t size = 0, r;
+	FILE *f;
+
+	f = fopen(filename, "rb");
+	if(!f)
+	{
+		ERROR("fopen: %s", strerror(errno));
+		return(NULL);
+	}
+
+	*length = 0;
+
+	do
+	{
+		if(*length == size)
+		{
+			size += 0x10000;
+			n = realloc(data, size);
+			if(!n)
+			{
+				ERROR("Out of memory.");
+				free(data);
+				fclose(f);
+				return(NULL);
+			}
+			data = n;
+		}
+
+		r = fread(data + *length, 1, size - *length, f);
+		*length += r;
+	}
+	while(r);
+
+	if(ferror(f))
+	{
+		ERROR("fread: %s", strerror(errno));
+		free(data);
+		data = NULL;
+	}
+
+	fclose(f);
+
+	return(data);
+}
+
+static int motion_pgm_number(uint8_t **p, uint8_t *end, uint32_t *v)
+{
+	/* Skips whitespace and comments before a decimal number. */
+	while(*p < end)
+	{
+		if(**p == '#') while(*p < end && **p != '\n') (*p)++;
+		else if(**p == ' ' || **p == '\t' || **p == '\r' || **p == '\n') (*p)++;
+		else break;
+	}
+
+	if(*p == end || **p < '0' || **p > '9') return(-1);
+
+	*v = 0;
+	while(*p < end && **p >= '0' && **p <= '9')
+	{
+		*v = *v * 10 + (**p - '0');
+		(*p)++;
+	}
+
+	return(0);
+}
+
+static uint8_t *motion_read_pgm(uint8_t *data, size_t length,
+                                uint32_t *width, uint32_t *height)
+{
+	uint8_t *p = data + 2, *end = data + length;
+	uint32_t maxval, v, i, n;
+	uint8_t *grey;
+	int ascii = (data[1] == '2');
+
+	if(motion_pgm_number(&p, end, width) ||
+	   motion_pgm_number(&p, end, height) ||
+	   motion_pgm_number(&p, end, &maxval) ||
+	   !*width || !*height || !maxval || maxval > 0xFFFF)
+	{
+		ERROR("Invalid PGM header.");
+		return(NULL);
+	}
+
+	/* A single whitespace byte separates the header from raw data. */
+	if(!ascii) p++;
+
+	n = *width * *height;
+	if(!ascii && p + (size_t) n * (maxval > 255 ? 2 : 1) > end)
+	{
+		ERROR("The PGM image is truncated.");
+		return(NULL);
+	}
+
+	grey = malloc(n);
+	if(!grey)
+	{
+		ERROR("Out of memory.");
+		return(NULL);
+	}
+
+	for(i = 0; i < n; i++)
+	{
+		if(ascii)
+		{
+			if(motion_pgm_number(&p, end, &v))
+			{
+				ERROR("The PGM image is truncated.");
+				free(grey);
+				return(NULL);
+			}
+		}
+		else if(maxval > 255)
+		{
+			v = (p[0] << 8) | p[1];
+			p += 2;
+		}
+		else v = *(p++);
+
+		if(v > maxval) v = maxval;
+		grey[i] = v * 255 / maxval;
+	}
+
+	return(grey);
+}
+
+static uint8_t *motion_read_png(uint8_t *data, size_t length,
+                                uint32_t *width, uint32_t *height)
+{
+	uint32_t x, y;
+	uint8_t *grey;
+	gdImage *im;
+
+	im = gdImageCreateFromPngPtr(length, data);
+	if(!im)
+	{
+		ERROR("Unable to read the PNG image.");
+		return(NULL);
+	}
+
+	*width  = gdImageSX(im);
+	*height = gdImageSY(im);
+
+	grey = malloc(*width * *height);
+	if(!grey)
+	{
+		ERROR("Out of memory.");
+		gdImageDestroy(im);
+		return(NULL);
+	}
+
+	for(y = 0; y < *height; y++)
+		for(x = 0; x < *width; x++)
+		{
+			int c = gdImageGetPixel(im, x, y);
+
+			grey[y * *width + x] = (((c & 0xFF0000) >> 16) +
+			                        ((c & 0x00FF00) >> 8) +
+			                         (c & 0x0000FF)) / 3;
+		}
+
+	gdImageDestroy(im);
+
+	return(grey);
+}
+
+int motion_load_mask(motion_t *m, char *filename)
+{
+	uint32_t width, height, x, y, cx, cy;
+	uint32_t x0, x1, y0, y1;
+	uint32_t masked = 0;
+	uint8_t *data, *grey;
+	size_t length;
+	int v;
+
+	data = motion_read_file(filename, &length);
+	if(!data) return(-1);
+
+	if(length >= 2 && data[0] == 'P' && (data[1] == '2' || data[1] == '5'))
+		grey = motion_read_pgm(data, length, &width, &height);
+	else if(length >= 8 && !memcmp(data, "\x89PNG\r\n\x1A\n", 8))
+		grey = motion_read_png(data, length, &width, &height);
+	else
+	{
+		ERROR("%s: Not a PGM or PNG image.", filename);
+		grey = NULL;
+	}
+
+	free(data);
+	if(!grey) return(-1);
+
+	if(width != m->width || height != m->height)
+		MSG("Scaling the %ux%u mask to %ux%u cells.",
+		    width, height, m->width, m->height);
+
+	for(cy = 0; cy < m->height; cy++)
+	{
+		y0 = cy * height / m->height;
+		y1 = (cy + 1) * height / m->height;
+		if(y1 <= y0) y1 = y0 + 1;
+
+		for(cx = 0; cx < m->width; cx++)
+		{
+			x0 = cx * width / m->width;
+			x1 = (cx + 1) * width / m->width;
+			if(x1 <= x0) x1 = x0 + 1;
+
+			v = 255;
+			for(y = y0; y < y1; y++)
+				for(x = x0; x < x1; x++)
+					if(grey[y * width + x] < v) v = grey[y * width + x];
+
+			m->mask[cy * m->width + cx] = motion_mask_value(v);
+			if(v < 255) masked++;
+		}
+	}
+
+	free(grey);
+
+	MSG("Loaded the mask %s, %u of %u cells masked.",
+	    filename, masked, m->width * m->height);
+
+	return(0);
+}
+
+int motion_save_mask(motion_t *m, char *filename)
+{
+	uint32_t i, n = m->width * m->height;
+	uint8_t *grey;
+	FILE *f;
+	int r;
+
+	grey = malloc(n);
+	if(!grey)
+	{
+		ERROR("Out of memory.");
+		return(-1);
+	}
+
+	for(i = 0; i < n; i++) grey[i] = motion_mask_grey(m->mask[i]);
+
+	f = fopen(filename, "wb");
+	if(!f)
+	{
+		ERROR("fopen: %s", strerror(errno));
+		free(grey);
+		return(-1);
+	}
+
+	fprintf(f, "P5\n%u %u\n255\n", m->width, m->height);
+	r = (fwrite(grey, 1, n, f) != n);
+	free(grey);
+
+	if(fclose(f) == EOF || r)
+	{
+		ERROR("Error writing the mask %s.", filename);
+		return(-1);
+	}
+
+	MSG("Saved the mask to %s.", filename);
+
+	return(0);
+}
+
+int motion_learn(motion_t *m)
+{
+	free(m->hits);
+
+	m->hits = calloc(m->width * m->height, sizeof(uint32_t));
+	if(!m->hits)
+	{
+		ERROR("Out of memory.");
+		return(-1);
+	}
+
+	return(0);
+}
+
+int motion_learned(motion_t *m)
+{
+	/* Masks the cells that changed at least half as often as the
+	 * busiest one. Returns the number of cells masked, or -1 if
+	 * too little changed to tell the LEDs from anything else. */
+	uint32_t i, n = m->width * m->height;
+	uint32_t max = 0, masked = 0;
+
+	if(!m->hits) return(-1);
+
+	for(i = 0; i < n; i++)
+		if(m->hits[i] > max) max = m->hits[i];
+
+	if(max < 2)
+	{
+		WARN("Too little changed to learn a mask. Keeping the current one.");
+		free(m->hits);
+		m->hits = NULL;
+		return(-1);
+	}
+
+	for(i = 0; i < n; i++)
+	{
+		if(m->hits[i] * 2 < max) continue;
+
+		m->mask[i] = 0;
+		masked++;
+	}
+
+	free(m->hits);
+	m->hits = NULL;
+
+	MSG("Learned a mask, %u of %u cells masked.", masked, n);
+
+	return(masked);
+}
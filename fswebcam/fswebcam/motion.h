@@ -0,0 +1,191 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_MOTION_H
+#define INC_MOTION_H
+
+#include <stdint.h>
+#include "fswebcam.h"
+#include "track.h"
+#include "flow.h"
+#include "filter.h"
+#include "noise.h"
+#include "light.h"
+
+/* The record written to stdout for every frame: one (row, diff) pair
+ * per column, followed by the delimiter byte. */
+#define MOTION_COLUMNS   (35)
+#define MOTION_RECORD    (MOTION_COLUMNS * 2 + 1)
+#define MOTION_DELIMITER (254)
+
+/* Framed output. Each frame is the sync byte, which never appears in
+ * the legacy record, a type byte and a little-endian 16-bit payload
+ * length, followed by the payload. Integers are little-endian and
+ * times are microseconds on the src_clock() timebase.
+ *
+ * MOTION_FRAME_COLUMNS:
+ *   uint32 sequence number
+ *   uint64 capture time
+ *   uint64 output time
+ *   MOTION_COLUMNS (row, diff) pairs, as in the legacy record
+ *   with flow, MOTION_COLUMNS int16 velocities in columns per
+ *   second * 256, positive to the right
+ *
+ * MOTION_FRAME_STATUS, when the camera is lost, about once a second
+ * while reconnecting, and when it is back:
+ *   uint8  MOTION_STATUS_OK or MOTION_STATUS_DEGRADED
+ *   uint32 reconnection attempts so far
+ *   uint64 output time
+ *
+ * MOTION_FRAME_TRACKS, in place of MOTION_FRAME_COLUMNS when tracking:
+ *   uint32 sequence number
+ *   uint64 capture time
+ *   uint64 output time
+ *   uint16 columns of cells
+ *   uint8  number of tracks, then for each:
+ *     uint16 id
+ *     uint16 centroid column * 256, weighted by difference
+ *     uint8  left, right, top and bottom cell, inclusive
+ *     int16  velocity in columns per second * 256
+ *     uint16 frames since first seen
+ *     uint16 cells
+ *
+ * MOTION_FRAME_GLOBAL, in place of either when so many cells changed
+ * at once that the lighting must have:
+ *   uint32 sequence number
+ *   uint64 capture time
+ *   uint64 output time
+ *   uint8  percentage of cells over the threshold
+ *   uint16 gain * 256 and int16 offset fitted to the previous frame
+ *
+ * MOTION_FRAME_SPARSE, in place of MOTION_FRAME_COLUMNS with sparse
+ * output, only when the active columns differ from the last one:
+ *   uint32 sequence number
+ *   uint64 capture time
+ *   uint64 output time
+ *   uint16 columns of cells
+ *   uint16 number of entries
+ *   uint8  bytes per entry, then for each active column, in order:
+ *     uint16 column
+ *     uint8  lowest active row and its difference, up to 255
+ *     with flow, int16 velocity as in MOTION_FRAME_COLUMNS
+ *
+ * MOTION_FRAME_HEARTBEAT, when the active columns have not changed
+ * for MOTION_HEARTBEAT microseconds:
+ *   uint32 sequence number
+ *   uint64 capture time
+ *   uint64 output time
+ */
+#define MOTION_SYNC          (0xFF)
+#define MOTION_HEADER        (4)
+#define MOTION_FRAME_COLUMNS (1)
+#define MOTION_FRAME_STATUS  (2)
+#define MOTION_FRAME_TRACKS  (3)
+#define MOTION_FRAME_GLOBAL  (4)
+#define MOTION_FRAME_SPARSE  (5)
+#define MOTION_FRAME_HEARTBEAT (6)
+#define MOTION_TRACK_SIZE    (14)
+#define MOTION_SPARSE_HEAD   (25)
+#define MOTION_SPARSE_ENTRY  (4)
+#define MOTION_SPARSE_FLOW   (6)
+#define MOTION_HEARTBEAT     (1000000)
+
+#define MOTION_STATUS_OK       (0)
+#define MOTION_STATUS_DEGRADED (1)
+
+#define MOTION_OUT_RECORD (0) /* Write the binary record */
+#define MOTION_OUT_CURR   (1) /* Draw the current frame on the terminal */
+#define MOTION_OUT_DIFF   (2) /* Draw the difference on the terminal */
+
+typedef struct {
+
+	/* Size of the reduced bitmaps. */
+	uint32_t width;
+	uint32_t height;
+
+	/* Detection options. With noise measured, each cell's threshold
+	 * is raised to its own limit * multiplier where that is higher. */
+	noise_t *noise;
+	uint32_t threshold;
+	uint32_t multiplier;
+	uint32_t lowerscan;
+	char output;
+	char framed;
+
+	/* The previous reduced frame, once there is one. */
+	avgbmp_t *prev;
+	char primed;
+
+	/* Each cell's difference is ANDed with its mask. All bits set
+	 * leave it as it is, none ignore the cell, and clearing only the
+	 * low bits ignores small changes. */
+	uint32_t *mask;
+
+	/* While learning a mask, how often each cell went over the
+	 * threshold. NULL otherwise. */
+	uint32_t *hits;
+
+	/* Each cell's difference in the last frame, and the cells over
+	 * the threshold as a bitset of words 64-bit words per row, after
+	 * any filtering. */
+	int *diff;
+	uint64_t *active;
+	uint32_t words;
+	filter_t *filter;
+
+	/* With tracking, the blobs followed in the active cells. */
+	tracker_t *tracker;
+
+	/* With light set, changes in the lighting are compensated for
+	 * and frames where most cells change are reported as such. */
+	light_t *light;
+
+	/* With flow, the horizontal motion of each column and the
+	 * capture time of the frame it was measured from. */
+	flow_t *flow;
+	uint64_t flow_at;
+
+	/* With sparse output, room for a frame of every column, the
+	 * entries last written, and when anything was last written. */
+	uint8_t *sparse;
+	uint8_t *sparse_last;
+	size_t sparse_length;
+	uint64_t sparse_at;
+
+	/* Result of the last call to motion_detect(). */
+	uint8_t record[MOTION_RECORD];
+	int diffsum;
+
+} motion_t;
+
+extern int motion_init(motion_t *m, uint32_t width, uint32_t height);
+extern void motion_free(motion_t *m);
+extern uint32_t motion_rows(motion_t *m);
+extern int motion_detect(motion_t *m, avgbmp_t *curr);
+extern int motion_output(motion_t *m, uint32_t seq, uint64_t captured);
+extern int motion_status(uint8_t status, uint32_t attempts);
+extern int motion_track(motion_t *m);
+extern int motion_auto_threshold(motion_t *m, uint32_t frames);
+extern int motion_filter(motion_t *m, uint32_t open, uint32_t persist, uint32_t frames);
+extern int motion_flow(motion_t *m, uint32_t budget);
+extern int motion_light(motion_t *m, char normalize, uint32_t percent);
+extern int motion_sparse(motion_t *m);
+
+/* Masks are greyscale images, white for cells to watch and black for
+ * cells to ignore. They are scaled to the cells if their size differs,
+ * each cell taking the darkest pixel it covers. */
+extern int motion_load_mask(motion_t *m, char *filename);
+extern int motion_save_mask(motion_t *m, char *filename);
+
+/* Learn a mask from the cells that change while the LEDs flash. */
+extern int motion_learn(motion_t *m);
+extern int motion_learned(motion_t *m);
+
+#endif
+
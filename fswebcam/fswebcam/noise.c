@@ -0,0 +1,141 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "noise.h"
+#include "log.h"
+
+int noise_init(noise_t *n, uint32_t width, uint32_t height, uint32_t frames)
+{
+	uint32_t cells = width * height;
+
+	memset(n, 0, sizeof(noise_t));
+
+	n->width  = width;
+	n->height = height;
+	n->frames = (frames < 1 ? 1 : frames);
+
+	/* The moving average takes 1 / 2^shift of each new frame. */
+	while((1U << (n->shift + 1)) <= n->frames) n->shift++;
+
+	n->mean   = calloc(cells, sizeof(int32_t));
+	n->square = calloc(cells, sizeof(int32_t));
+	n->limit  = calloc(cells, sizeof(uint16_t));
+	if(!n->mean || !n->square || !n->limit)
+	{
+		ERROR("Out of memory.");
+		noise_free(n);
+		return(-1);
+	}
+
+	return(0);
+}
+
+void noise_free(noise_t *n)
+{
+	free(n->mean);
+	free(n->square);
+	free(n->limit);
+	n->mean   = NULL;
+	n->square = NULL;
+	n->limit  = NULL;
+}
+
+static uint32_t noise_sqrt(uint32_t v)
+{
+	uint32_t r = 0, b = 1U << 30;
+
+	while(b > v) b >>= 2;
+
+	while(b)
+	{
+		if(v >= r + b)
+		{
+			v -= r + b;
+			r = (r >> 1) + b;
+		}
+		else r >>= 1;
+
+		b >>= 2;
+	}
+
+	return(r);
+}
+
+static void noise_limits(noise_t *n, uint32_t rows)
+{
+	/* With everything * 256, the deviation is sqrt(var * 256) / 16. */
+	uint32_t t, lo = 0xFFFF, hi = 0;
+	int64_t var, limit;
+
+	for(t = 0; t < n->width * rows; t++)
+	{
+		var = n->square[t] - ((int64_t) n->mean[t] * n->mean[t] >> 8);
+		if(var < 0) var = 0;
+
+		limit = (n->mean[t] + NOISE_SIGMA * 16 * noise_sqrt(var) + 255) >> 8;
+		n->limit[t] = (limit < 1 ? 1 : limit > 0xFFFF ? 0xFFFF : limit);
+
+		if(n->limit[t] < lo) lo = n->limit[t];
+		if(n->limit[t] > hi) hi = n->limit[t];
+	}
+
+	if(n->seen == n->frames)
+		MSG("Measured the noise over %u frames, cell thresholds %u to %u.",
+		    n->frames, lo, hi);
+}
+
+void noise_update(noise_t *n, avgbmp_t *curr, avgbmp_t *prev,
+                  uint64_t *active, uint32_t words, uint32_t rows)
+{
+	uint32_t h, w, t;
+	int32_t d, *mean, *square;
+	uint64_t bits;
+
+	if(rows > n->height) rows = n->height;
+
+	/* Exact averages at first, then a moving average. */
+	n->seen++;
+
+	for(h = 0; h < rows; h++)
+	{
+		for(w = 0; w < n->width; w++)
+		{
+			/* Once measured, motion is left out. Before then
+			 * too much would be. */
+			bits = active[h * words + (w >> 6)];
+			if(n->seen > n->frames && (bits & (1ULL << (w & 63)))) continue;
+
+			t = h * n->width + w;
+			d = abs((int) curr[t] - (int) prev[t]);
+			mean = &n->mean[t];
+			square = &n->square[t];
+
+			if(n->seen <= n->frames)
+			{
+				*mean   += ((d << 8) - *mean) / (int32_t) n->seen;
+				*square += ((d * d << 8) - *square) / (int32_t) n->seen;
+			}
+			else
+			{
+				*mean   += ((d << 8) - *mean) >> n->shift;
+				*square += ((d * d << 8) - *square) >> n->shift;
+			}
+		}
+	}
+
+	if(n->seen >= n->frames && (n->seen - n->frames) % NOISE_REFRESH == 0)
+		noise_limits(n, rows);
+}
+
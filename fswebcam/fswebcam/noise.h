@@ -0,0 +1,51 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_NOISE_H
+#define INC_NOISE_H
+
+#include <stdint.h>
+#include "fswebcam.h"
+
+/* Per-cell noise: the mean and spread of each cell's difference from
+ * one frame to the next. Averaged over the first frames frames, which
+ * should see no motion, then followed with a moving average of about
+ * as many frames while nothing moves in the cell. Each cell's limit is NOISE_SIGMA deviations above
+ * its mean. */
+#define NOISE_SIGMA   (4)
+#define NOISE_REFRESH (16)
+
+typedef struct {
+
+	uint32_t width;
+	uint32_t height;
+
+	uint32_t frames;
+	uint32_t shift;
+	uint32_t seen;
+
+	/* Mean difference and mean squared difference * 256. */
+	int32_t *mean;
+	int32_t *square;
+
+	/* Each cell's limit, or 0 until the first frames are seen. */
+	uint16_t *limit;
+
+} noise_t;
+
+extern int noise_init(noise_t *n, uint32_t width, uint32_t height, uint32_t frames);
+extern void noise_free(noise_t *n);
+
+/* Adds the differences between two frames. After the first frames,
+ * cells set in the active bitset are skipped. */
+extern void noise_update(noise_t *n, avgbmp_t *curr, avgbmp_t *prev,
+                         uint64_t *active, uint32_t words, uint32_t rows);
+
+#endif
+
@@ -0,0 +1,989 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include "fswebcam.h"
+#include "src.h"
+#include "motion.h"
+#include "loop.h"
+#include "control.h"
+#include "stripe.h"
+#include "pipeline.h"
+#include "log.h"
+
+/* Capacity of each queue. Must be a power of two, and larger than
+ * the number of frames a source can hold (32 for V4L2). */
+#define PIPE_QUEUE_SIZE (64)
+
+#define PIPE_FRAME (0)
+#define PIPE_ERROR (-1)
+#define PIPE_STOP  (1)
+
+typedef struct {
+	uint32_t seq;
+	int status;
+
+	/* The captured frame, valid until the slot is released. */
+	int slot;
+	void *img;
+	uint32_t length;
+
+	/* Stage times, see src_clock(). */
+	uint64_t captured;
+	uint64_t grabbed;
+	uint64_t decoded;
+
+	/* The reduced frame, owned by the decode worker. */
+	avgbmp_t *bitmap;
+
+} fswc_frame_t;
+
+/* Single producer, single consumer ring. head is only written by the
+ * producer and tail only by the consumer, each published with a
+ * release store that the other side reads with an acquire load, so
+ * frames are copied in and out without locks. The consumer sleeps on
+ * a semaphore posted once per frame, or if the queue is read from an
+ * event loop, an eventfd counter that several queues may share. */
+typedef struct {
+
+	fswc_frame_t ring[PIPE_QUEUE_SIZE];
+	uint32_t head;
+	uint32_t tail;
+
+	sem_t items;
+	int wakefd;
+
+} fswc_queue_t;
+
+typedef struct {
+
+	pthread_t thread;
+	fswc_capture_t *c;
+
+	/* A copy of the source and a decoder for reduce_img(). */
+	src_t view;
+	fswc_decoder_t *decoder;
+
+	fswc_queue_t in;      /* capture  -> worker:   grabbed frames */
+	fswc_queue_t out;     /* worker   -> detector: reduced frames */
+	fswc_queue_t release; /* worker   -> capture:  finished slots */
+	fswc_queue_t free;    /* detector -> worker:   spare bitmaps */
+
+	avgbmp_t *bitmap[2];
+
+} fswc_worker_t;
+
+typedef struct {
+
+	fswc_capture_t *c;
+
+	unsigned int workers;
+	fswc_worker_t *worker;
+
+	/* Counts the slots pushed to the release queues. */
+	int released;
+
+	pthread_t detector;
+
+} fswc_pipeline_t;
+
+typedef struct {
+
+	fswc_capture_t *c;
+	fswc_loop_t loop;
+	control_t *control;
+
+	/* The camera, or NULL if the source is polled. */
+	fswc_watch_t *camera;
+	char paused;
+
+	fswc_watch_t *signal;
+	fswc_watch_t *watchdog;
+	fswc_watch_t *report;
+
+	/* Stripe decoders, used if c->pool points here. */
+	stripe_pool_t stripes;
+
+	/* The decode threads, or NULL to decode on this thread. */
+	fswc_pipeline_t *pipe;
+	uint32_t in_flight;
+	uint32_t limit;
+
+	/* Decoding on this thread. */
+	fswc_frame_t frame;
+	fswc_decoder_t *decoder;
+
+	uint32_t seq;
+	uint32_t skipped;
+	char applied;
+
+	/* Frame counts at the last watchdog tick and statistics report. */
+	uint32_t watched;
+	uint32_t reported;
+	uint64_t reported_at;
+
+	/* CAPTURE_RESTART or CAPTURE_LOST if that is what ended the loop. */
+	int end;
+
+} fswc_run_t;
+
+static int queue_init(fswc_queue_t *q, int wakefd)
+{
+	q->head = 0;
+	q->tail = 0;
+
+	if(sem_init(&q->items, 0, 0) == -1)
+	{
+		ERROR("sem_init: %s", strerror(errno));
+		return(-1);
+	}
+
+	q->wakefd = wakefd;
+
+	return(0);
+}
+
+static int queue_push(fswc_queue_t *q, fswc_frame_t *f)
+{
+	uint32_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+
+	if(head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) >= PIPE_QUEUE_SIZE)
+	{
+		ERROR("Pipeline queue overflow.");
+		return(-1);
+	}
+
+	q->ring[head & (PIPE_QUEUE_SIZE - 1)] = *f;
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+
+	if(q->wakefd >= 0)
+	{
+		uint64_t one = 1;
+		if(write(q->wakefd, &one, sizeof(one)) != sizeof(one))
+			ERROR("Unable to signal the pipeline: %s", strerror(errno));
+	}
+	else sem_post(&q->items);
+
+	return(0);
+}
+
+static int queue_trypop(fswc_queue_t *q, fswc_frame_t *f)
+{
+	uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+	if(__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == tail) return(-1);
+
+	*f = q->ring[tail & (PIPE_QUEUE_SIZE - 1)];
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return(0);
+}
+
+static void queue_pop(fswc_queue_t *q, fswc_frame_t *f)
+{
+	/* Only for queues with their own semaphore. */
+	while(sem_wait(&q->items) == -1);
+	queue_trypop(q, f);
+}
+
+static void capture_report(fswc_capture_t *c)
+{
+	histogram_report(&c->grabbed);
+	histogram_report(&c->decoded);
+	histogram_report(&c->output);
+
+	histogram_reset(&c->grabbed);
+	histogram_reset(&c->decoded);
+	histogram_reset(&c->output);
+}
+
+static void capture_retune(fswc_capture_t *c)
+{
+	/* Picks up the settings handed over by run_tune(). */
+	motion_t *m = c->motion;
+
+	m->threshold  = __atomic_load_n(&c->tune.threshold,  __ATOMIC_RELAXED);
+	m->multiplier = __atomic_load_n(&c->tune.multiplier, __ATOMIC_RELAXED);
+	m->lowerscan  = __atomic_load_n(&c->tune.lowerscan,  __ATOMIC_RELAXED);
+	c->idle       = __atomic_load_n(&c->tune.idle,       __ATOMIC_RELAXED);
+
+	/* Frames already decoded may be short of rows until the
+	 * decoders see the new count. */
+	__atomic_store_n(&c->rows, motion_rows(m), __ATOMIC_RELAXED);
+
+	if(!c->idle && __atomic_load_n(&c->idling, __ATOMIC_RELAXED))
+	{
+		INFO("Idle mode disabled.");
+		__atomic_store_n(&c->idling, 0, __ATOMIC_RELAXED);
+	}
+
+	c->quiet = 0;
+
+	MSG("Threshold %u, multiplier %u, lowerscan %u, idle %u.",
+	   m->threshold, m->multiplier, m->lowerscan, c->idle);
+}
+
+static void capture_calibrate(fswc_capture_t *c, fswc_frame_t *f)
+{
+	/* Starts learning a mask when asked to, and applies it once
+	 * the time is up. */
+	uint32_t seconds = __atomic_exchange_n(&c->calibrate, 0, __ATOMIC_RELAXED);
+
+	if(seconds && !motion_learn(c->motion))
+	{
+		MSG("Learning a mask for %u seconds.", seconds);
+		c->learning_until = f->captured + seconds * 1000000ULL;
+	}
+
+	if(!c->learning_until || f->captured < c->learning_until) return;
+
+	c->learning_until = 0;
+
+	if(motion_learned(c->motion) >= 0 && c->mask)
+		motion_save_mask(c->motion, c->mask);
+}
+
+static void capture_detected(fswc_capture_t *c, fswc_frame_t *f)
+{
+	/* Idle state: after c->idle frames without a cell over the
+	 * threshold only one frame in c->idle_skip is decoded, and the
+	 * camera is asked for c->idle_fps if set. */
+	char idling;
+
+	if(__atomic_exchange_n(&c->retune, 0, __ATOMIC_ACQUIRE)) capture_retune(c);
+	capture_calibrate(c, f);
+
+	idling = __atomic_load_n(&c->idling, __ATOMIC_RELAXED);
+
+	if(motion_detect(c->motion, f->bitmap))
+	{
+		c->quiet = 0;
+		if(idling)
+		{
+			INFO("Motion detected, leaving idle mode.");
+			__atomic_store_n(&c->idling, 0, __ATOMIC_RELAXED);
+		}
+	}
+	else if(c->idle && !idling && ++c->quiet >= c->idle)
+	{
+		INFO("No motion for %u frames, entering idle mode.", c->quiet);
+		__atomic_store_n(&c->idling, 1, __ATOMIC_RELAXED);
+	}
+
+	motion_output(c->motion, f->seq, f->captured);
+
+	histogram_record(&c->grabbed, f->grabbed - f->captured);
+	histogram_record(&c->decoded, f->decoded - f->captured);
+	histogram_record(&c->output, src_clock() - f->captured);
+
+	if(c->report && *c->report)
+	{
+		*c->report = 0;
+		capture_report(c);
+	}
+}
+
+static void capture_duty(fswc_capture_t *c, char *applied, uint32_t *skipped)
+{
+	/* Apply a change of idle state to the source. */
+	char idling = __atomic_load_n(&c->idling, __ATOMIC_RELAXED);
+
+	if(idling == *applied) return;
+
+	*applied = idling;
+	*skipped = 0;
+
+	if(!c->idle_fps) return;
+
+	if(!idling) src_set_fps(c->src, c->fps);
+	else if(src_set_fps(c->src, c->idle_fps))
+		WARN("Unable to lower the frame rate, skipping frames only.");
+}
+
+static int capture_reduce(fswc_capture_t *c, fswc_decoder_t *d, src_t *src, avgbmp_t *bitmap)
+{
+	uint32_t rows = __atomic_load_n(&c->rows, __ATOMIC_RELAXED);
+	int r;
+
+	if(c->pool)
+	{
+		r = stripe_reduce(c->pool, d, src, bitmap, c->scale, rows, c->reduce);
+		if(r != 1) return(r);
+	}
+
+	if(c->pyramid)
+		return(reduce_img_gated(d, src, bitmap, c->scale, rows, c->reduce, c->pyramid));
+
+	return(reduce_img(d, src, bitmap, c->scale, rows, c->reduce));
+}
+
+static void *capture_worker(void *arg)
+{
+	fswc_worker_t *w = (fswc_worker_t *) arg;
+	fswc_frame_t f, b;
+
+	while(1)
+	{
+		queue_pop(&w->in, &f);
+		if(f.status == PIPE_STOP) break;
+
+		queue_pop(&w->free, &b);
+		f.bitmap = b.bitmap;
+
+		w->view.img    = f.img;
+		w->view.length = f.length;
+
+		if(capture_reduce(w->c, w->decoder, &w->view, f.bitmap)) f.status = PIPE_ERROR;
+		f.decoded = src_clock();
+
+		/* The source buffer can be reused as soon as it is decoded. */
+		queue_push(&w->release, &f);
+		queue_push(&w->out, &f);
+	}
+
+	queue_push(&w->out, &f);
+
+	return(NULL);
+}
+
+static void *capture_detector(void *arg)
+{
+	fswc_pipeline_t *p = (fswc_pipeline_t *) arg;
+	fswc_worker_t *w;
+	fswc_frame_t f;
+	uint32_t seq;
+
+	/* Frames are dealt to the workers in turn, so collecting them
+	 * in the same order puts them back in sequence. */
+	for(seq = 0; ; seq++)
+	{
+		w = &p->worker[seq % p->workers];
+
+		queue_pop(&w->out, &f);
+		if(f.status == PIPE_STOP) break;
+
+		if(f.status == PIPE_FRAME) capture_detected(p->c, &f);
+
+		queue_push(&w->free, &f);
+	}
+
+	return(NULL);
+}
+
+static void pipeline_release(fswc_pipeline_t *p)
+{
+	/* Called once for each count read from p->released, which
+	 * guarantees one of the release queues has a slot ready. */
+	fswc_frame_t f;
+	unsigned int i;
+
+	while(1)
+	{
+		for(i = 0; i < p->workers; i++)
+		{
+			if(queue_trypop(&p->worker[i].release, &f)) continue;
+
+			src_release(p->c->src, f.slot);
+			return;
+		}
+	}
+}
+
+static uint64_t pipeline_released(fswc_pipeline_t *p)
+{
+	/* Requeue every slot the workers are done with. */
+	uint64_t i, n;
+
+	if(read(p->released, &n, sizeof(n)) != sizeof(n)) return(0);
+	for(i = 0; i < n; i++) pipeline_release(p);
+
+	return(n);
+}
+
+static void pipeline_free(fswc_pipeline_t *p)
+{
+	fswc_worker_t *w;
+	unsigned int i;
+
+	for(i = 0; i < p->workers; i++)
+	{
+		w = &p->worker[i];
+
+		sem_destroy(&w->in.items);
+		sem_destroy(&w->out.items);
+		sem_destroy(&w->release.items);
+		sem_destroy(&w->free.items);
+
+		free(w->bitmap[0]);
+		free(w->bitmap[1]);
+		fswc_decoder_free(w->decoder);
+	}
+
+	close(p->released);
+	free(p->worker);
+}
+
+static int pipeline_init(fswc_pipeline_t *p, fswc_capture_t *c)
+{
+	fswc_worker_t *w;
+	fswc_frame_t f;
+	unsigned int i, b;
+
+	memset(p, 0, sizeof(fswc_pipeline_t));
+	p->c = c;
+
+	p->released = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(p->released == -1)
+	{
+		ERROR("eventfd: %s", strerror(errno));
+		return(-1);
+	}
+
+	p->worker = calloc(c->threads, sizeof(fswc_worker_t));
+	if(!p->worker)
+	{
+		ERROR("Out of memory.");
+		close(p->released);
+		return(-1);
+	}
+
+	memset(&f, 0, sizeof(f));
+
+	for(i = 0; i < c->threads; i++)
+	{
+		w = &p->worker[i];
+		w->c = c;
+		w->view = *c->src;
+
+		/* Count the worker now so pipeline_free() cleans it up. */
+		p->workers++;
+
+		if(queue_init(&w->in, -1) ||
+		   queue_init(&w->out, -1) ||
+		   queue_init(&w->release, p->released) ||
+		   queue_init(&w->free, -1))
+		{
+			pipeline_free(p);
+			return(-1);
+		}
+
+		for(b = 0; b < 2; b++)
+		{
+			w->bitmap[b] = calloc(c->motion->width * c->motion->height, sizeof(avgbmp_t));
+			if(!w->bitmap[b])
+			{
+				ERROR("Out of memory.");
+				pipeline_free(p);
+				return(-1);
+			}
+
+			f.bitmap = w->bitmap[b];
+			queue_push(&w->free, &f);
+		}
+
+		w->decoder = fswc_decoder_new();
+		if(!w->decoder)
+		{
+			pipeline_free(p);
+			return(-1);
+		}
+	}
+
+	return(0);
+}
+
+static void pipeline_start(fswc_pipeline_t *p)
+{
+	sigset_t all, old;
+	unsigned int i;
+
+	/* Signals are handled by the capture thread. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	for(i = 0; i < p->workers; i++)
+		pthread_create(&p->worker[i].thread, NULL, capture_worker, &p->worker[i]);
+	pthread_create(&p->detector, NULL, capture_detector, p);
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	MSG("Decoding on %u threads.", p->workers);
+}
+
+static void pipeline_stop(fswc_pipeline_t *p, uint32_t seq)
+{
+	fswc_frame_t f;
+	unsigned int i;
+
+	/* Stop the workers in the order the detector will next visit
+	 * them, so every frame already captured is still reported. */
+	memset(&f, 0, sizeof(f));
+	f.status = PIPE_STOP;
+
+	for(i = 0; i < p->workers; i++)
+		queue_push(&p->worker[(seq + i) % p->workers].in, &f);
+
+	for(i = 0; i < p->workers; i++) pthread_join(p->worker[i].thread, NULL);
+	pthread_join(p->detector, NULL);
+
+	pipeline_released(p);
+}
+
+static int run_frame(void *arg, uint32_t events);
+
+static void run_pause(fswc_run_t *r, char paused)
+{
+	/* Stop or resume grabbing while the decoders are full. */
+	if(r->paused == paused) return;
+	r->paused = paused;
+
+	if(r->camera) loop_modify(&r->loop, r->camera, (paused ? 0 : EPOLLIN));
+	else r->loop.poll = (paused ? NULL : run_frame);
+}
+
+static int run_frame(void *arg, uint32_t events)
+{
+	/* The camera has a frame ready, or for sources without a
+	 * descriptor, the loop is ready for another one. */
+	fswc_run_t *r = (fswc_run_t *) arg;
+	fswc_capture_t *c = r->c;
+	fswc_frame_t *f = &r->frame;
+
+	capture_duty(c, &r->applied, &r->skipped);
+
+	if(src_grab(c->src) == -1)
+	{
+		r->end = CAPTURE_LOST;
+		r->loop.quit = 1;
+		return(0);
+	}
+
+	f->grabbed = src_clock();
+
+	/* While idle, drop frames without decoding them. */
+	if(r->applied && (++r->skipped % c->idle_skip))
+	{
+		if(r->pipe) src_release(c->src, c->src->slot);
+		return(0);
+	}
+
+	f->seq      = r->seq;
+	f->status   = PIPE_FRAME;
+	f->captured = c->src->timestamp;
+
+	if(!r->pipe)
+	{
+		/* Frames that fail to decode are dropped. */
+		if(!capture_reduce(c, r->decoder, c->src, f->bitmap))
+		{
+			f->decoded = src_clock();
+			capture_detected(c, f);
+			r->seq++;
+		}
+
+		return(0);
+	}
+
+	f->slot   = c->src->slot;
+	f->img    = c->src->img;
+	f->length = c->src->length;
+	f->bitmap = NULL;
+
+	queue_push(&r->pipe->worker[r->seq % r->pipe->workers].in, f);
+
+	r->seq++;
+	if(++r->in_flight >= r->limit) run_pause(r, 1);
+
+	return(0);
+}
+
+static int run_released(void *arg, uint32_t events)
+{
+	fswc_run_t *r = (fswc_run_t *) arg;
+
+	r->in_flight -= pipeline_released(r->pipe);
+	if(r->in_flight < r->limit) run_pause(r, 0);
+
+	return(0);
+}
+
+static void run_tune(fswc_run_t *r, fswc_tune_t *t)
+{
+	/* Settings used by the detector are handed over to it. The
+	 * others are only used on this thread. */
+	fswc_capture_t *c = r->c;
+
+	__atomic_store_n(&c->tune.threshold,  t->threshold,  __ATOMIC_RELAXED);
+	__atomic_store_n(&c->tune.multiplier, t->multiplier, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->tune.lowerscan,  t->lowerscan,  __ATOMIC_RELAXED);
+	__atomic_store_n(&c->tune.idle,       t->idle,       __ATOMIC_RELAXED);
+	__atomic_store_n(&c->retune, 1, __ATOMIC_RELEASE);
+
+	c->idle_skip = (t->idle_skip < 1 ? 1 : t->idle_skip);
+
+	if(c->idle_fps != t->idle_fps)
+	{
+		c->idle_fps = t->idle_fps;
+		if(r->applied) src_set_fps(c->src, (c->idle_fps ? c->idle_fps : c->fps));
+	}
+}
+
+static int run_reload(fswc_run_t *r, char *name, char *value)
+{
+	/* Applies a change of configuration, ending the loop if the
+	 * capture has to be set up again. */
+	fswc_tune_t t;
+	int i;
+
+	if(!r->c->reload) return(-1);
+
+	i = r->c->reload(r->c->reload_arg, name, value, &t);
+
+	if(i == 0) run_tune(r, &t);
+	else if(i == CAPTURE_RESTART)
+	{
+		MSG("Restarting the capture.");
+		r->end = CAPTURE_RESTART;
+		r->loop.quit = 1;
+	}
+
+	return(i);
+}
+
+static int run_signal(void *arg, uint32_t events)
+{
+	fswc_run_t *r = (fswc_run_t *) arg;
+	struct signalfd_siginfo si;
+
+	while(read(r->signal->fd, &si, sizeof(si)) == sizeof(si))
+	{
+		switch(si.ssi_signo)
+		{
+		case SIGUSR1:
+			INFO("Caught signal SIGUSR1.");
+			*r->c->report = 1;
+			break;
+
+		case SIGHUP:
+			INFO("Caught signal SIGHUP.");
+			MSG("Received HUP signal... reloading configuration.");
+			run_reload(r, NULL, NULL);
+			break;
+
+		default:
+			INFO("Caught signal %s", (si.ssi_signo == SIGINT ? "SIGINT" : "SIGTERM"));
+			*r->c->stop = 1;
+			r->loop.quit = 1;
+			break;
+		}
+	}
+
+	return(0);
+}
+
+static int run_watchdog(void *arg, uint32_t events)
+{
+	/* The camera descriptor is only read once it is ready, so a
+	 * camera that stops delivering frames is caught here. */
+	fswc_run_t *r = (fswc_run_t *) arg;
+
+	loop_expirations(r->watchdog);
+	if(r->paused) return(0);
+
+	if(r->c->src->captured_frames == r->watched)
+	{
+		ERROR("Timed out waiting for frame!");
+		r->end = CAPTURE_LOST;
+		r->loop.quit = 1;
+		return(0);
+	}
+
+	r->watched = r->c->src->captured_frames;
+
+	return(0);
+}
+
+static void run_stats(fswc_run_t *r, char *s, size_t size)
+{
+	uint64_t now = src_clock();
+	uint32_t frames = r->c->src->captured_frames;
+	double seconds = (now - r->reported_at) / 1000000.0;
+
+	snprintf(s, size, "frames %u skipped %u detected %u fps %0.1f idle %i threads %u",
+	   frames, r->c->src->skipped_frames, r->seq,
+	   (seconds > 0 ? (frames - r->reported) / seconds : 0),
+	   __atomic_load_n(&r->c->idling, __ATOMIC_RELAXED),
+	   (r->pipe ? r->pipe->workers : 1));
+
+	r->reported = frames;
+	r->reported_at = now;
+}
+
+static int run_report(void *arg, uint32_t events)
+{
+	fswc_run_t *r = (fswc_run_t *) arg;
+	char s[CONTROL_LINE];
+
+	loop_expirations(r->report);
+
+	run_stats(r, s, sizeof(s));
+	MSG("Stats: %s", s);
+
+	/* The detector logs its latency histograms on the next frame. */
+	*r->c->report = 1;
+
+	return(0);
+}
+
+static int run_command(void *arg, char *line, char *reply, size_t size)
+{
+	fswc_run_t *r = (fswc_run_t *) arg;
+
+	if(!strcmp(line, "stats"))
+	{
+		run_stats(r, reply, size);
+		*r->c->report = 1;
+	}
+	else if(!strcmp(line, "quit"))
+	{
+		snprintf(reply, size, "ok");
+		*r->c->stop = 1;
+		r->loop.quit = 1;
+	}
+	else if(!strcmp(line, "reload") || !strncmp(line, "set ", 4))
+	{
+		char *name = NULL, *value = NULL;
+		int i;
+
+		if(*line == 's')
+		{
+			name  = strtok(line + 4, " ");
+			value = strtok(NULL, " ");
+		}
+
+		if(*line == 's' && (!name || !value))
+			snprintf(reply, size, "error usage: set <option> <value>");
+		else if((i = run_reload(r, name, value)) == -1)
+			snprintf(reply, size, "error %s", (name ? "cannot set that option" : "reload failed"));
+		else snprintf(reply, size, (i == CAPTURE_RESTART ? "ok restarting" : "ok"));
+	}
+	else if(!strncmp(line, "calibrate ", 10))
+	{
+		uint32_t seconds = strtoul(line + 10, NULL, 10);
+
+		if(!seconds) snprintf(reply, size, "error usage: calibrate <seconds>");
+		else
+		{
+			__atomic_store_n(&r->c->calibrate, seconds, __ATOMIC_RELAXED);
+			snprintf(reply, size, "ok");
+		}
+	}
+	else if(!strcmp(line, "help"))
+	{
+		snprintf(reply, size, "commands: stats reload set calibrate quit help");
+	}
+	else snprintf(reply, size, "error unknown command");
+
+	return(0);
+}
+
+static int run_init(fswc_run_t *r, sigset_t *signals)
+{
+	fswc_capture_t *c = r->c;
+	int fd;
+
+	if(loop_init(&r->loop)) return(-1);
+
+	c->rows   = motion_rows(c->motion);
+	c->retune = 0;
+
+	c->calibrate      = 0;
+	c->learning_until = 0;
+
+	/* Signals arrive as reads on a descriptor. */
+	fd = signalfd(-1, signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if(fd == -1)
+	{
+		ERROR("signalfd: %s", strerror(errno));
+		return(-1);
+	}
+
+	r->signal = loop_watch(&r->loop, fd, EPOLLIN, run_signal, r);
+	if(!r->signal)
+	{
+		close(fd);
+		return(-1);
+	}
+	r->signal->owned = 1;
+
+	fd = src_fd(c->src);
+	if(fd >= 0)
+	{
+		r->camera = loop_watch(&r->loop, fd, EPOLLIN, run_frame, r);
+		if(!r->camera) return(-1);
+	}
+	else
+	{
+		r->loop.poll     = run_frame;
+		r->loop.poll_arg = r;
+	}
+
+	if(fd >= 0 && c->src->timeout)
+	{
+		r->watchdog = loop_timer(&r->loop, c->src->timeout * 1000, run_watchdog, r);
+		if(!r->watchdog) return(-1);
+	}
+
+	if(c->stats)
+	{
+		r->report = loop_timer(&r->loop, c->stats * 1000, run_report, r);
+		if(!r->report) return(-1);
+	}
+
+	if(c->control)
+	{
+		r->control = control_open(&r->loop, c->control, run_command, r);
+		if(!r->control) return(-1);
+	}
+
+	if(c->stripes)
+	{
+		/* The calling thread decodes one stripe itself. */
+		if(stripe_init(&r->stripes, c->stripes - 1)) return(-1);
+		c->pool = &r->stripes;
+	}
+
+	if(c->threads > 1)
+	{
+		r->pipe = malloc(sizeof(fswc_pipeline_t));
+		if(!r->pipe)
+		{
+			ERROR("Out of memory.");
+			return(-1);
+		}
+
+		if(pipeline_init(r->pipe, c))
+		{
+			free(r->pipe);
+			r->pipe = NULL;
+			return(-1);
+		}
+
+		if(!loop_watch(&r->loop, r->pipe->released, EPOLLIN, run_released, r))
+		{
+			pipeline_free(r->pipe);
+			free(r->pipe);
+			r->pipe = NULL;
+			return(-1);
+		}
+
+		/* Leave one buffer with the driver so capture never stalls. */
+		r->limit = c->src->slots - 1;
+
+		pipeline_start(r->pipe);
+	}
+	else
+	{
+		r->frame.bitmap = calloc(c->motion->width * c->motion->height, sizeof(avgbmp_t));
+		if(!r->frame.bitmap)
+		{
+			ERROR("Out of memory.");
+			return(-1);
+		}
+
+		r->decoder = fswc_decoder_new();
+		if(!r->decoder) return(-1);
+	}
+
+	r->reported_at = src_clock();
+
+	return(0);
+}
+
+static void run_free(fswc_run_t *r)
+{
+	/* Leave the camera at its normal frame rate. */
+	if(r->applied && r->c->idle_fps) src_set_fps(r->c->src, r->c->fps);
+
+	if(r->pipe)
+	{
+		pipeline_stop(r->pipe, r->seq);
+		pipeline_free(r->pipe);
+		free(r->pipe);
+	}
+
+	if(r->c->pool)
+	{
+		stripe_free(r->c->pool);
+		r->c->pool = NULL;
+	}
+
+	if(r->control) control_close(r->control);
+
+	free(r->frame.bitmap);
+	fswc_decoder_free(r->decoder);
+	loop_free(&r->loop);
+}
+
+int fswc_capture(fswc_capture_t *c)
+{
+	fswc_run_t r;
+	sigset_t signals, old;
+	int ret = -1;
+
+	if(c->idle_skip < 1) c->idle_skip = 1;
+
+	histogram_init(&c->grabbed, "capture to grab");
+	histogram_init(&c->decoded, "capture to decode");
+	histogram_init(&c->output,  "capture to output");
+
+	if(c->threads > 1 && c->src->slots < 2)
+	{
+		WARN("The source cannot hold frames. Decoding on one thread.");
+		c->threads = 1;
+	}
+
+	memset(&r, 0, sizeof(r));
+	r.c = c;
+	r.loop.epfd = -1;
+
+	/* Taken from the handlers for the life of the loop. */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGHUP);
+	sigaddset(&signals, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &signals, &old);
+
+	if(!*c->stop && !run_init(&r, &signals)) ret = loop_run(&r.loop);
+	if(!ret && !*c->stop) ret = r.end;
+
+	run_free(&r);
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if(*c->stop) MSG("Received TERM signal... exiting.");
+
+	capture_report(c);
+
+	return(ret);
+}
@@ -0,0 +1,113 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_PIPELINE_H
+#define INC_PIPELINE_H
+
+#include <stdint.h>
+#include "src.h"
+#include "motion.h"
+#include "histogram.h"
+#include "stripe.h"
+
+#define PIPE_MAX_WORKERS (8)
+
+/* Returned by fswc_capture() when the configuration changed in a way
+ * that needs the capture set up again, or when the camera stopped
+ * delivering frames. */
+#define CAPTURE_RESTART (1)
+#define CAPTURE_LOST    (2)
+
+/* Settings that can change while capturing. */
+typedef struct {
+
+	uint32_t threshold;
+	uint32_t multiplier;
+	uint32_t lowerscan;
+	uint32_t idle;
+	uint32_t idle_skip;
+	uint32_t idle_fps;
+
+} fswc_tune_t;
+
+/* Reloads the configuration (name is NULL) or sets one option, and
+ * fills in the settings that can change while capturing. Returns 0
+ * if they are all that changed, CAPTURE_RESTART if the capture must
+ * be set up again, or -1 if nothing changed. */
+typedef int (*fswc_reload_fn_t)(void *arg, char *name, char *value, fswc_tune_t *t);
+
+typedef struct {
+
+	/* An open source and an initialised detector. */
+	src_t *src;
+	motion_t *motion;
+	uint16_t scale;
+	int reduce; /* REDUCE_PIXELS or REDUCE_DC */
+
+	/* Number of decode threads. With 0 or 1, or a source that
+	 * cannot hold frames, everything runs on the calling thread. */
+	unsigned int threads;
+
+	/* Split frames with restart markers into this many stripes,
+	 * decoded in parallel. 0 to decode frames whole. */
+	unsigned int stripes;
+	stripe_pool_t *pool;
+
+	/* Decode only the parts of frames where tiles changed by more
+	 * than this many levels, or 0 to decode them whole. */
+	uint32_t pyramid;
+
+	/* Adaptive duty cycle. */
+	uint32_t fps;
+	uint32_t idle;
+	uint32_t idle_skip;
+	uint32_t idle_fps;
+
+	/* Log capture statistics every this many seconds, or 0. */
+	uint32_t stats;
+
+	/* Path of a control socket to listen on, or NULL. */
+	char *control;
+
+	/* Set to end the capture, or to have the detector log and
+	 * reset its latency histograms. */
+	volatile char *stop;
+	volatile char *report;
+
+	/* Called on SIGHUP and for the reload and set commands. */
+	fswc_reload_fn_t reload;
+	void *reload_arg;
+
+	/* Settings waiting to be picked up by the detector, and the
+	 * rows of cells the decoders fill in. */
+	fswc_tune_t tune;
+	char retune;
+	uint32_t rows;
+
+	/* Seconds to learn a mask for, set by the calibrate command and
+	 * picked up by the detector, and where to save it, or NULL. */
+	uint32_t calibrate;
+	uint64_t learning_until;
+	char *mask;
+
+	/* Updated by the detector. */
+	uint32_t quiet;
+	char idling;
+
+	/* Time from capture to each stage, in microseconds. */
+	histogram_t grabbed;
+	histogram_t decoded;
+	histogram_t output;
+
+} fswc_capture_t;
+
+extern int fswc_capture(fswc_capture_t *c);
+
+#endif
+
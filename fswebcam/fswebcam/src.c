@@ -192,6 +192,9 @@ int src_close(src_t *src)
 		}
 	}
 	
+	if(src->skipped_frames)
+		MSG("Skipped %i stale frames.", src->skipped_frames);
+	
 	r = src_mod[src->type]->close(src);
 	
 	if(src->source) free(src->source);
@@ -201,10 +204,17 @@ int src_close(src_t *src)
 
 int src_grab(src_t *src)
 {
-	int r = src_mod[src->type]->grab(src);
+	int r;
+	
+	/* Sources that know when the frame was captured set this. */
+	src->timestamp = 0;
+	
+	r = src_mod[src->type]->grab(src);
 	
 	if(!r)
 	{
+		if(!src->timestamp) src->timestamp = src_clock();
+		
 		if(!src->captured_frames) gettimeofday(&src->tv_first, NULL);
 		gettimeofday(&src->tv_last, NULL);
 		
@@ -214,6 +224,45 @@ int src_grab(src_t *src)
 	return(r);
 }
 
+int src_set_fps(src_t *src, uint32_t fps)
+{
+	uint32_t old = src->fps;
+	
+	if(!src_mod[src->type]->set_fps) return(-1);
+	
+	src->fps = fps;
+	if(src_mod[src->type]->set_fps(src))
+	{
+		src->fps = old;
+		return(-1);
+	}
+	
+	return(0);
+}
+
+int src_release(src_t *src, int slot)
+{
+	if(!src_mod[src->type]->release) return(-1);
+	return(src_mod[src->type]->release(src, slot));
+}
+
+int src_fd(src_t *src)
+{
+	if(!src_mod[src->type]->get_fd) return(-1);
+	return(src_mod[src->type]->get_fd(src));
+}
+
+uint64_t src_clock(void)
+{
+	/* Microseconds on the monotonic clock. This is the clock V4L2
+	 * timestamps buffers with, and the one behind Node's hrtime(). */
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return((uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
 /* Pointers are great things. Terrible things yes, but great. */
 /* These work but are very ugly and will be re-written soon. */
 
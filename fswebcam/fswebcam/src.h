@@ -73,6 +73,15 @@ typedef struct {
 	/* Last captured image */
 	uint32_t length;
 	void *img;
+	uint64_t timestamp; /* Capture time, see src_clock() */
+	
+	/* Frame holding: if hold is set before opening, grabbed frames
+	 * stay valid until passed back with src_release(). The source
+	 * sets slots to the number of frames it can hold at once (0 if
+	 * unsupported) and slot to the one the last grab returned. */
+	char     hold;
+	uint32_t slots;
+	int      slot;
 	
 	/* Input Options */
 	char    *input;
@@ -81,6 +90,8 @@ typedef struct {
 	uint32_t delay;
 	uint32_t timeout;
 	char     use_read;
+	uint32_t buffers; /* Capture buffers to request, 0 for default */
+	char     latest;  /* Return only the newest frame on each grab */
 	
 	/* List Options */
 	uint8_t list;
@@ -91,10 +102,19 @@ typedef struct {
 	uint32_t height;
 	uint32_t fps;
 	
+	/* Region of interest. If roi_width is set only this part of
+	 * each frame is decoded. A source that crops on the device
+	 * updates width and height to match and clears the region. */
+	uint32_t roi_x;
+	uint32_t roi_y;
+	uint32_t roi_width;
+	uint32_t roi_height;
+	
 	src_option_t **option;
 	
 	/* For calculating capture FPS */
 	uint32_t captured_frames;
+	uint32_t skipped_frames;
 	struct timeval tv_first;
 	struct timeval tv_last;
 	
@@ -110,11 +130,24 @@ typedef struct {
 	int (*close)(src_t *);
 	int (*grab)(src_t *);
 	
+	/* Optional: apply a new src->fps to an open source. */
+	int (*set_fps)(src_t *);
+	
+	/* Optional: give a held frame back to the source. */
+	int (*release)(src_t *, int);
+	
+	/* Optional: a descriptor that polls readable when a frame is ready. */
+	int (*get_fd)(src_t *);
+	
 } src_mod_t;
 
 extern int src_open(src_t *src, char *source);
 extern int src_close(src_t *src);
 extern int src_grab(src_t *src);
+extern int src_set_fps(src_t *src, uint32_t fps);
+extern int src_release(src_t *src, int slot);
+extern int src_fd(src_t *src);
+extern uint64_t src_clock(void);
 
 extern int src_set_option(src_option_t ***options, char *name, char *value);
 extern int src_get_option_by_number(src_option_t **opt, int number, char **name, char **value);
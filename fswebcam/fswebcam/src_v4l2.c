@@ -25,6 +25,30 @@
 
 #ifdef HAVE_V4L2
 
+/* Newer than the included videodev2.h. */
+#ifndef V4L2_BUF_FLAG_TIMESTAMP_MASK
+#define V4L2_BUF_FLAG_TIMESTAMP_MASK      0xe000
+#define V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC 0x2000
+#endif
+
+#ifndef VIDIOC_S_SELECTION
+struct v4l2_selection {
+	__u32 type;
+	__u32 target;
+	__u32 flags;
+	struct v4l2_rect r;
+	__u32 reserved[9];
+};
+
+#define V4L2_SEL_TGT_CROP         0x0000
+#define V4L2_SEL_TGT_CROP_DEFAULT 0x0001
+#define V4L2_SEL_FLAG_GE          (1 << 0)
+#define V4L2_SEL_FLAG_LE          (1 << 1)
+
+#define VIDIOC_G_SELECTION _IOWR('V', 94, struct v4l2_selection)
+#define VIDIOC_S_SELECTION _IOWR('V', 95, struct v4l2_selection)
+#endif
+
 typedef struct {
 	void *start;
 	size_t length;
@@ -44,6 +68,9 @@ typedef struct {
 	
 	int pframe;
 	
+	/* Buffers grabbed in hold mode and not yet released. */
+	uint32_t held;
+	
 } src_v4l2_t;
 
 static int src_v4l2_close(src_t *src);
@@ -615,17 +642,88 @@ int src_v4l2_set_pix_format(src_t *src)
 	return(-1);
 }
 
-int src_v4l2_set_fps(src_t *src)
+int src_v4l2_set_roi(src_t *src)
+{
+	src_v4l2_t *s = (src_v4l2_t *) src->state;
+	struct v4l2_selection sel;
+	struct v4l2_format fmt;
+	
+	/* Crop to the region of interest on the device, so the rest of
+	 * the sensor is never transferred or decoded. This only helps if
+	 * the frames shrink to match. The exact region is asked for, but
+	 * not every driver honours the flags, so one that moves the region
+	 * or scales it back up to the old size is reset. */
+	memset(&sel, 0, sizeof(sel));
+	sel.type     = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	sel.target   = V4L2_SEL_TGT_CROP;
+	sel.flags    = V4L2_SEL_FLAG_GE | V4L2_SEL_FLAG_LE;
+	sel.r.left   = src->roi_x;
+	sel.r.top    = src->roi_y;
+	sel.r.width  = src->roi_width;
+	sel.r.height = src->roi_height;
+	
+	if(ioctl(s->fd, VIDIOC_S_SELECTION, &sel) == -1)
+	{
+		DEBUG("VIDIOC_S_SELECTION: %s", strerror(errno));
+		return(-1);
+	}
+	
+	fmt = s->fmt;
+	fmt.fmt.pix.width  = src->roi_width;
+	fmt.fmt.pix.height = src->roi_height;
+	
+	if(sel.r.left != src->roi_x || sel.r.top != src->roi_y ||
+	   sel.r.width != src->roi_width || sel.r.height != src->roi_height ||
+	   ioctl(s->fd, VIDIOC_S_FMT, &fmt) == -1 ||
+	   fmt.fmt.pix.width != src->roi_width ||
+	   fmt.fmt.pix.height != src->roi_height)
+	{
+		memset(&sel, 0, sizeof(sel));
+		sel.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		sel.target = V4L2_SEL_TGT_CROP_DEFAULT;
+		
+		if(ioctl(s->fd, VIDIOC_G_SELECTION, &sel) != -1)
+		{
+			sel.target = V4L2_SEL_TGT_CROP;
+			ioctl(s->fd, VIDIOC_S_SELECTION, &sel);
+		}
+		
+		ioctl(s->fd, VIDIOC_S_FMT, &s->fmt);
+		
+		return(-1);
+	}
+	
+	MSG("Cropping to %ix%i at %i,%i on the device.",
+	    src->roi_width, src->roi_height, src->roi_x, src->roi_y);
+	
+	s->fmt = fmt;
+	src->width  = src->roi_width;
+	src->height = src->roi_height;
+	
+	src->roi_x = src->roi_y = 0;
+	src->roi_width = src->roi_height = 0;
+	
+	return(0);
+}
+
+static int src_v4l2_s_parm(src_t *src)
 {
 	src_v4l2_t *s = (src_v4l2_t *) src->state;
 	struct v4l2_streamparm setfps;
 	
 	memset(&setfps, 0, sizeof(setfps));
 	
+	/* A zero time per frame asks the driver for its nominal rate. */
 	setfps.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	setfps.parm.capture.timeperframe.numerator = 1;
+	setfps.parm.capture.timeperframe.numerator = (src->fps ? 1 : 0);
 	setfps.parm.capture.timeperframe.denominator = src->fps;
-	if(ioctl(s->fd, VIDIOC_S_PARM, &setfps) == -1)
+	
+	return(ioctl(s->fd, VIDIOC_S_PARM, &setfps));
+}
+
+int src_v4l2_set_fps(src_t *src)
+{
+	if(src_v4l2_s_parm(src) == -1)
 	{
 		/* Not fatal - just warn about it */
 		WARN("Error setting frame rate:");
@@ -658,7 +756,7 @@ int src_v4l2_set_mmap(src_t *src)
 	
 	memset(&s->req, 0, sizeof(s->req));
 	
-	s->req.count  = 4;
+	s->req.count  = (src->buffers ? src->buffers : 4);
 	s->req.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	s->req.memory = V4L2_MEMORY_MMAP;
 	
@@ -678,6 +776,9 @@ int src_v4l2_set_mmap(src_t *src)
 		return(-1);
         }
 	
+	if(src->buffers && s->req.count != src->buffers)
+		MSG("Driver allocated %i capture buffers.", s->req.count);
+	
 	s->buffer = calloc(s->req.count, sizeof(v4l2_buffer_t));
 	if(!s->buffer)
 	{
@@ -754,6 +855,9 @@ int src_v4l2_set_mmap(src_t *src)
 		return(-1);
 	}
 	
+	/* Held buffers are tracked in a 32-bit mask. */
+	if(src->hold && s->req.count <= 32) src->slots = s->req.count;
+	
 	return(0);
 }
 
@@ -842,6 +946,10 @@ static int src_v4l2_open(src_t *src)
 		return(-1);
 	}
 	
+	/* Crop on the device if possible, else while decoding. */
+	if(src->roi_width && src_v4l2_set_roi(src))
+		INFO("The device cannot crop. Cropping while decoding.");
+	
 	/* Set the frame-rate if > 0 */
 	if(src->fps) src_v4l2_set_fps(src);
 	
@@ -925,7 +1033,8 @@ static int src_v4l2_grab(src_t *src)
 	
 	if(s->map)
 	{
-		if(s->pframe >= 0)
+		/* In hold mode the caller requeues frames with src_release(). */
+		if(s->pframe >= 0 && !src->slots)
 		{
 			if(ioctl(s->fd, VIDIOC_QBUF, &s->buf) == -1)
 			{
@@ -945,10 +1054,47 @@ static int src_v4l2_grab(src_t *src)
 			return(-1);
 		}
 		
+		/* In latest mode drain every frame that is ready, requeue
+		 * the older ones straight away and keep only the newest. */
+		while(src->latest)
+		{
+			struct v4l2_buffer next;
+			
+			memset(&next, 0, sizeof(next));
+			next.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			next.memory = V4L2_MEMORY_MMAP;
+			
+			if(ioctl(s->fd, VIDIOC_DQBUF, &next) == -1)
+			{
+				if(errno != EAGAIN)
+					WARN("VIDIOC_DQBUF: %s", strerror(errno));
+				break;
+			}
+			
+			if(ioctl(s->fd, VIDIOC_QBUF, &s->buf) == -1)
+			{
+				ERROR("VIDIOC_QBUF: %s", strerror(errno));
+				return(-1);
+			}
+			
+			s->buf = next;
+			src->skipped_frames++;
+		}
+		
 		src->img    = s->buffer[s->buf.index].start;
 		src->length = s->buffer[s->buf.index].length;
+		src->slot   = s->buf.index;
+		
+		/* Use the driver's capture time when it is on our clock. */
+		if((s->buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+		   V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+		{
+			src->timestamp = (uint64_t) s->buf.timestamp.tv_sec * 1000000 +
+			                 s->buf.timestamp.tv_usec;
+		}
 		
-		s->pframe = s->buf.index;
+		if(src->slots) s->held |= 1U << s->buf.index;
+		else s->pframe = s->buf.index;
 	}
 	else
 	{
@@ -964,16 +1110,103 @@ static int src_v4l2_grab(src_t *src)
 		
 		src->img = s->buffer[0].start;
 		src->length = r;
+		src->slot = -1;
 	}
 	
 	return(0);
 }
 
+static int src_v4l2_change_fps(src_t *src)
+{
+	src_v4l2_t *s = (src_v4l2_t *) src->state;
+	enum v4l2_buf_type type;
+	uint32_t b;
+	int r;
+	
+	/* Some drivers accept a new frame rate while streaming. */
+	if(src_v4l2_s_parm(src) == 0) return(0);
+	if(!s->map || errno != EBUSY) return(src_v4l2_set_fps(src));
+	
+	/* Others (uvcvideo) only while stopped. STREAMOFF returns every
+	 * buffer to us, so queue them all again except those the caller
+	 * is still holding, which the next grab or src_release requeues. */
+	DEBUG("Restarting stream to change the frame rate.");
+	
+	type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if(ioctl(s->fd, VIDIOC_STREAMOFF, &type) == -1)
+	{
+		ERROR("VIDIOC_STREAMOFF: %s", strerror(errno));
+		return(-1);
+	}
+	
+	r = src_v4l2_set_fps(src);
+	
+	for(b = 0; b < s->req.count; b++)
+	{
+		struct v4l2_buffer buf;
+		
+		if((int) b == s->pframe || s->held & (1U << b)) continue;
+		
+		memset(&buf, 0, sizeof(buf));
+		buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index  = b;
+		
+		if(ioctl(s->fd, VIDIOC_QBUF, &buf) == -1)
+		{
+			ERROR("VIDIOC_QBUF: %s", strerror(errno));
+			return(-1);
+		}
+	}
+	
+	if(ioctl(s->fd, VIDIOC_STREAMON, &type) == -1)
+	{
+		ERROR("Error restarting stream.");
+		ERROR("VIDIOC_STREAMON: %s", strerror(errno));
+		return(-1);
+	}
+	
+	return(r);
+}
+
+static int src_v4l2_release(src_t *src, int slot)
+{
+	src_v4l2_t *s = (src_v4l2_t *) src->state;
+	struct v4l2_buffer buf;
+	
+	if(slot < 0 || slot >= (int) src->slots) return(-1);
+	if(~s->held & (1U << slot)) return(0);
+	
+	memset(&buf, 0, sizeof(buf));
+	buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index  = slot;
+	
+	if(ioctl(s->fd, VIDIOC_QBUF, &buf) == -1)
+	{
+		ERROR("VIDIOC_QBUF: %s", strerror(errno));
+		return(-1);
+	}
+	
+	s->held &= ~(1U << slot);
+	
+	return(0);
+}
+
+static int src_v4l2_get_fd(src_t *src)
+{
+	src_v4l2_t *s = (src_v4l2_t *) src->state;
+	return(s->fd);
+}
+
 src_mod_t src_v4l2 = {
 	"v4l2", SRC_TYPE_DEVICE,
 	src_v4l2_open,
 	src_v4l2_close,
-	src_v4l2_grab
+	src_v4l2_grab,
+	src_v4l2_change_fps,
+	src_v4l2_release,
+	src_v4l2_get_fd
 };
 
 #else /* #ifdef HAVE_V4L2 */
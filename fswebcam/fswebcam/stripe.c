@@ -0,0 +1,493 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "fswebcam.h"
+#include "src.h"
+#include "stripe.h"
+#include "log.h"
+
+/* The layout of a baseline JPEG frame with restart markers. */
+typedef struct {
+
+	uint8_t *img;
+	uint32_t length;
+
+	/* Bytes before the entropy-coded data, and the SOF marker. */
+	uint32_t header;
+	uint32_t sof;
+
+	uint32_t width;
+	uint32_t height;
+
+	/* MCU size in pixels, and MCUs per row and per column. */
+	uint32_t mcu_w;
+	uint32_t mcu_h;
+	uint32_t mcu_cols;
+	uint32_t mcu_rows;
+
+	/* MCUs per restart interval, and the end of the data. */
+	uint32_t interval;
+	uint32_t intervals;
+	uint32_t end;
+
+	/* The DHT segment to insert at offset at, if dht is not 0. */
+	uint8_t *seg;
+	uint32_t dht;
+	uint32_t at;
+
+} stripe_frame_t;
+
+typedef struct stripe_job {
+
+	stripe_frame_t *frame;
+
+	/* MCU rows of the frame in this stripe, and its first restart
+	 * interval and entropy-coded data. */
+	uint32_t top;
+	uint32_t bottom;
+	uint32_t first;
+	uint32_t start;
+	uint32_t stop;
+
+	/* The part of the stripe to reduce, and where to. */
+	src_t src;
+	avgbmp_t *rbitmap;
+	uint16_t scale;
+	uint32_t rows;
+	int mode;
+
+	int r;
+	int *remaining;
+
+	struct stripe_job *next;
+
+} stripe_job_t;
+
+static int stripe_parse(stripe_frame_t *f)
+{
+	/* Returns 0 if the frame can be split at its restart markers. */
+	uint8_t *img = f->img;
+	uint32_t p, len, i, h, v;
+	uint32_t max_h = 1, max_v = 1;
+	uint32_t components = 0;
+
+	if(f->length < 4 || img[0] != 0xFF || img[1] != 0xD8) return(1);
+
+	f->sof = 0;
+	f->interval = 0;
+	f->header = 0;
+
+	p = 2;
+	while(!f->header && p + 4 <= f->length)
+	{
+		if(img[p] != 0xFF) return(1);
+
+		/* Skip fill bytes. */
+		if(img[p + 1] == 0xFF)
+		{
+			p++;
+			continue;
+		}
+
+		len = (img[p + 2] << 8) + img[p + 3];
+		if(p + 2 + len > f->length) return(1);
+
+		switch(img[p + 1])
+		{
+		case 0xC0: /* SOF0, baseline */
+		case 0xC1: /* SOF1, extended sequential */
+
+			if(len < 8) return(1);
+
+			f->sof        = p;
+			f->height     = (img[p + 5] << 8) + img[p + 6];
+			f->width      = (img[p + 7] << 8) + img[p + 8];
+			components    = img[p + 9];
+
+			if(len < 8 + components * 3) return(1);
+
+			for(i = 0; i < components; i++)
+			{
+				h = img[p + 11 + i * 3] >> 4;
+				v = img[p + 11 + i * 3] & 0x0F;
+				if(h > max_h) max_h = h;
+				if(v > max_v) max_v = v;
+			}
+
+			/* A single component is coded in 8x8 blocks. */
+			if(components == 1) max_h = max_v = 1;
+
+			break;
+
+		case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+		case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE:
+		case 0xCF:
+			/* Progressive, lossless and arithmetic coding. */
+			return(1);
+
+		case 0xDD: /* DRI */
+			if(len < 4) return(1);
+			f->interval = (img[p + 4] << 8) + img[p + 5];
+			break;
+
+		case 0xDA: /* SOS */
+
+			/* Only single interleaved scans can be split. */
+			if(!f->sof || !f->interval || img[p + 4] != components)
+				return(1);
+
+			f->header = p + 2 + len;
+			break;
+		}
+
+		p += 2 + len;
+	}
+
+	if(!f->header || !f->width || !f->height) return(1);
+
+	f->mcu_w    = max_h * 8;
+	f->mcu_h    = max_v * 8;
+	f->mcu_cols = (f->width + f->mcu_w - 1) / f->mcu_w;
+	f->mcu_rows = (f->height + f->mcu_h - 1) / f->mcu_h;
+
+	f->intervals = (f->mcu_cols * f->mcu_rows + f->interval - 1) / f->interval;
+
+	return(0);
+}
+
+static int stripe_markers(stripe_frame_t *f, uint32_t *first, uint32_t *bound, unsigned int n)
+{
+	/* Finds the RSTn marker ending the interval before each of the n
+	 * intervals in first, in one pass over the data. Stuffed zero
+	 * bytes are not markers. Returns 1 if the frame is cut short. */
+	uint8_t *img = f->img;
+	uint32_t p, m, v;
+	unsigned int i;
+
+	/* Stripes starting in the first interval start at the header. */
+	for(i = 0; i < n && !first[i]; i++) bound[i] = f->header;
+
+	m = 0;
+	f->end = f->length;
+
+	for(p = f->header; p + 1 < f->length; p++)
+	{
+		if(img[p] != 0xFF) continue;
+
+		v = img[p + 1];
+		if(v >= 0xD0 && v <= 0xD7)
+		{
+			m++;
+			while(i < n && first[i] == m) bound[i++] = p;
+			p++;
+		}
+		else if(v == 0xD9)
+		{
+			f->end = p;
+			break;
+		}
+	}
+
+	/* The last stripe may run to the end of the data. */
+	while(i < n && first[i] >= f->intervals) bound[i++] = f->end;
+
+	if(i < n || m + 1 < f->intervals) return(1);
+
+	return(0);
+}
+
+static int stripe_run(stripe_job_t *j, fswc_decoder_t *d)
+{
+	/* Builds a frame from the restart intervals of the stripe in the
+	 * decoder's scratch buffer and reduces it. Its RSTn markers are
+	 * renumbered from RST0. */
+	stripe_frame_t *f = j->frame;
+	uint32_t header, length, height, sof, p;
+	uint8_t *img, *data;
+
+	height = j->bottom * f->mcu_h;
+	if(height > f->height) height = f->height;
+	height -= j->top * f->mcu_h;
+
+	header = f->header + f->dht;
+	length = header + (j->stop - j->start) + 2;
+
+	img = fswc_decoder_scratch(d, length);
+	if(!img) return(-1);
+
+	/* MJPEG data may lack the DHT segment required for decoding... */
+	memcpy(img, f->img, f->at);
+	memcpy(img + f->at, f->seg, f->dht);
+	memcpy(img + f->at + f->dht, f->img + f->at, f->header - f->at);
+
+	sof = f->sof + (f->at <= f->sof ? f->dht : 0);
+	img[sof + 5] = height >> 8;
+	img[sof + 6] = height & 0xFF;
+
+	data = img + header;
+	memcpy(data, f->img + j->start, j->stop - j->start);
+
+	for(p = 0; p + 1 < j->stop - j->start; p++)
+	{
+		if(data[p] != 0xFF) continue;
+		if(data[p + 1] < 0xD0 || data[p + 1] > 0xD7) continue;
+
+		data[p + 1] = 0xD0 + ((data[p + 1] - j->first) & 7);
+		p++;
+	}
+
+	img[length - 2] = 0xFF;
+	img[length - 1] = 0xD9;
+
+	j->src.img    = img;
+	j->src.length = length;
+	j->src.height = height;
+
+	return(reduce_img(d, &j->src, j->rbitmap, j->scale, j->rows, j->mode));
+}
+
+static void *stripe_thread(void *arg)
+{
+	stripe_thread_t *t = (stripe_thread_t *) arg;
+	stripe_pool_t *p = t->pool;
+	stripe_job_t *j;
+
+	pthread_mutex_lock(&p->lock);
+
+	while(1)
+	{
+		while(!p->queue && !p->stop) pthread_cond_wait(&p->work, &p->lock);
+		if(!p->queue) break;
+
+		j = p->queue;
+		p->queue = j->next;
+
+		pthread_mutex_unlock(&p->lock);
+		j->r = stripe_run(j, t->decoder);
+		pthread_mutex_lock(&p->lock);
+
+		if(!--*j->remaining) pthread_cond_broadcast(&p->done);
+	}
+
+	pthread_mutex_unlock(&p->lock);
+
+	return(NULL);
+}
+
+int stripe_init(stripe_pool_t *p, unsigned int threads)
+{
+	stripe_thread_t *t;
+
+	memset(p, 0, sizeof(stripe_pool_t));
+
+	if(threads > STRIPE_MAX) threads = STRIPE_MAX;
+
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->work, NULL);
+	pthread_cond_init(&p->done, NULL);
+
+	for(p->threads = 0; p->threads < threads; p->threads++)
+	{
+		t = &p->thread[p->threads];
+		t->pool = p;
+
+		t->decoder = fswc_decoder_new();
+		if(!t->decoder)
+		{
+			stripe_free(p);
+			return(-1);
+		}
+
+		if(pthread_create(&t->thread, NULL, stripe_thread, t))
+		{
+			ERROR("Unable to start the stripe decoders.");
+			fswc_decoder_free(t->decoder);
+			stripe_free(p);
+			return(-1);
+		}
+	}
+
+	return(0);
+}
+
+void stripe_free(stripe_pool_t *p)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&p->lock);
+	p->stop = 1;
+	pthread_cond_broadcast(&p->work);
+	pthread_mutex_unlock(&p->lock);
+
+	for(i = 0; i < p->threads; i++)
+	{
+		pthread_join(p->thread[i].thread, NULL);
+		fswc_decoder_free(p->thread[i].decoder);
+	}
+	p->threads = 0;
+
+	pthread_cond_destroy(&p->done);
+	pthread_cond_destroy(&p->work);
+	pthread_mutex_destroy(&p->lock);
+}
+
+int stripe_reduce(stripe_pool_t *p, fswc_decoder_t *d, src_t *src,
+                  avgbmp_t *rbitmap, uint16_t scale, uint32_t rows, int mode)
+{
+	stripe_frame_t f;
+	stripe_job_t job[STRIPE_MAX + 1];
+	stripe_job_t *j;
+	uint32_t split[STRIPE_MAX + 2];
+	uint32_t first[STRIPE_MAX + 2];
+	uint32_t bound[STRIPE_MAX + 2];
+	uint32_t y0, h, end, cells, row, target;
+	uint32_t s, e, j0, j1;
+	unsigned int n, i, stripes;
+	int remaining;
+	int r;
+
+	memset(&f, 0, sizeof(f));
+	f.img    = src->img;
+	f.length = src->length;
+
+	if(stripe_parse(&f)) return(1);
+
+	/* The frame is read in place. Any missing DHT segment is
+	 * inserted as each stripe is copied out. */
+	f.dht = fswc_jpeg_dht(f.img, f.length, &f.at, &f.seg);
+
+	/* The rows of the frame to reduce. */
+	y0 = src->roi_y;
+	h  = (src->roi_width ? src->roi_height : f.height);
+	if(rows * scale < h) h = rows * scale;
+	if(y0 >= f.height) h = 0;
+	else if(h > f.height - y0) h = f.height - y0;
+	end = y0 + h;
+
+	cells = ((src->roi_width ? src->roi_width : f.width) + scale - 1) / scale;
+
+	/* Stripes start and end on MCU rows that begin a restart
+	 * interval. Rows outside the region are not decoded at all. */
+	row = y0 / f.mcu_h;
+	while(row && (row * f.mcu_cols) % f.interval) row--;
+	split[0] = row;
+	n = 1;
+
+	/* Split evenly where an interval starts on a row of cells. */
+	stripes = p->threads + 1;
+
+	for(i = 1; i < stripes && h; i++)
+	{
+		target = y0 + (uint64_t) h * i / stripes;
+
+		for(row = split[n - 1] + 1; row * f.mcu_h < end; row++)
+		{
+			if(row * f.mcu_h < target) continue;
+			if((row * f.mcu_cols) % f.interval) continue;
+			if(row * f.mcu_h <= y0 || (row * f.mcu_h - y0) % scale) continue;
+
+			split[n++] = row;
+			break;
+		}
+	}
+
+	row = (end + f.mcu_h - 1) / f.mcu_h;
+	while(row < f.mcu_rows && (row * f.mcu_cols) % f.interval) row++;
+	split[n] = row;
+
+	/* One stripe covering the whole frame saves nothing. */
+	if(!h || (n == 1 && split[0] == 0 && split[1] >= f.mcu_rows))
+		return(1);
+
+	/* Find where each stripe's data starts and ends. */
+	for(i = 0; i <= n; i++)
+		first[i] = (split[i] * f.mcu_cols + f.interval - 1) / f.interval;
+
+	if(stripe_markers(&f, first, bound, n + 1)) return(1);
+
+	remaining = n;
+
+	for(i = 0; i < n; i++)
+	{
+		j = &job[i];
+		memset(j, 0, sizeof(stripe_job_t));
+
+		j->frame     = &f;
+		j->top       = split[i];
+		j->bottom    = split[i + 1];
+		j->first     = first[i];
+		j->start     = (first[i] ? bound[i] + 2 : f.header);
+		j->stop      = bound[i + 1];
+		j->scale     = scale;
+		j->mode      = mode;
+		j->remaining = &remaining;
+
+		/* Rows of cells in the stripe. Every split but the first
+		 * and last is on a cell boundary. */
+		s  = j->top * f.mcu_h;
+		e  = j->bottom * f.mcu_h;
+		if(e > end) e = end;
+		j0 = (i ? (s - y0) / scale : 0);
+		j1 = (i < n - 1 ? (e - y0) / scale : (h + scale - 1) / scale);
+
+		j->rows    = j1 - j0;
+		j->rbitmap = rbitmap + j0 * cells;
+
+		j->src = *src;
+		j->src.width      = f.width;
+		j->src.roi_x      = (src->roi_width ? src->roi_x : 0);
+		j->src.roi_width  = (src->roi_width ? src->roi_width : f.width);
+		j->src.roi_y      = y0 + j0 * scale - s;
+		j->src.roi_height = e - (y0 + j0 * scale);
+
+		j->next = (i + 1 < n ? &job[i + 1] : NULL);
+	}
+
+	/* Queue every stripe, then help decode until ours are done. */
+	pthread_mutex_lock(&p->lock);
+
+	job[n - 1].next = p->queue;
+	p->queue = &job[0];
+	pthread_cond_broadcast(&p->work);
+
+	while(remaining)
+	{
+		if(!p->queue)
+		{
+			pthread_cond_wait(&p->done, &p->lock);
+			continue;
+		}
+
+		j = p->queue;
+		p->queue = j->next;
+
+		pthread_mutex_unlock(&p->lock);
+		j->r = stripe_run(j, d);
+		pthread_mutex_lock(&p->lock);
+
+		if(!--*j->remaining) pthread_cond_broadcast(&p->done);
+	}
+
+	pthread_mutex_unlock(&p->lock);
+
+	r = 0;
+	for(i = 0; i < n; i++) if(job[i].r) r = -1;
+
+	return(r);
+}
+
@@ -0,0 +1,55 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_STRIPE_H
+#define INC_STRIPE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "fswebcam.h"
+#include "src.h"
+
+#define STRIPE_MAX (8)
+
+typedef struct {
+
+	struct stripe_pool *pool;
+	pthread_t thread;
+	fswc_decoder_t *decoder;
+
+} stripe_thread_t;
+
+/* Threads that decode the stripes of MJPEG frames with restart
+ * markers. Any number of threads may submit frames at once. */
+typedef struct stripe_pool {
+
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+
+	struct stripe_job *queue;
+	char stop;
+
+	unsigned int threads;
+	stripe_thread_t thread[STRIPE_MAX];
+
+} stripe_pool_t;
+
+extern int stripe_init(stripe_pool_t *p, unsigned int threads);
+extern void stripe_free(stripe_pool_t *p);
+
+/* Reduces a frame as reduce_img() does, one stripe per thread and
+ * one on the calling thread, which decodes with d. Returns 1 without
+ * touching the bitmap if the frame cannot be split, so the caller can
+ * decode it whole. */
+extern int stripe_reduce(stripe_pool_t *p, fswc_decoder_t *d, src_t *src,
+                         avgbmp_t *rbitmap, uint16_t scale, uint32_t rows, int mode);
+
+#endif
+
@@ -0,0 +1,321 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "track.h"
+#include "log.h"
+
+/* Blobs smaller than this are noise. */
+#define TRACK_MIN_CELLS (2)
+
+/* A blob continues a track if its centroid is within this many
+ * columns of where the track was expected, plus half its width. */
+#define TRACK_GATE (4)
+
+/* Tracks are reported once seen in this many frames, and dropped
+ * after this many frames unseen. */
+#define TRACK_CONFIRM (2)
+#define TRACK_MISSES  (5)
+
+int tracker_init(tracker_t *t, uint32_t width, uint32_t height)
+{
+	/* At most one run in every two cells. */
+	uint32_t runs = height * ((width + 1) / 2);
+
+	memset(t, 0, sizeof(tracker_t));
+
+	t->width  = width;
+	t->height = height;
+	t->words  = (width + 63) / 64;
+
+	t->run    = malloc(runs * sizeof(track_run_t));
+	t->parent = malloc(runs * sizeof(uint32_t));
+	t->blob   = malloc(runs * sizeof(track_t));
+	t->weight = malloc(runs * sizeof(uint64_t));
+	t->moment = malloc(runs * sizeof(uint64_t));
+	if(!t->run || !t->parent || !t->blob || !t->weight || !t->moment)
+	{
+		ERROR("Out of memory.");
+		tracker_free(t);
+		return(-1);
+	}
+
+	t->next_id = 1;
+
+	return(0);
+}
+
+void tracker_free(tracker_t *t)
+{
+	free(t->run);
+	free(t->parent);
+	free(t->blob);
+	free(t->weight);
+	free(t->moment);
+	t->run    = NULL;
+	t->parent = NULL;
+	t->blob   = NULL;
+	t->weight = NULL;
+	t->moment = NULL;
+}
+
+static uint32_t track_next(uint64_t *row, uint32_t words, uint32_t from, int set)
+{
+	/* The first cell from here on that is set, or clear. */
+	uint32_t i = from >> 6;
+	uint64_t w;
+
+	if(i >= words) return(words << 6);
+
+	w = (set ? row[i] : ~row[i]) & (~0ULL << (from & 63));
+	while(!w)
+	{
+		if(++i == words) return(words << 6);
+		w = (set ? row[i] : ~row[i]);
+	}
+
+	return((i << 6) + __builtin_ctzll(w));
+}
+
+static uint32_t track_find(uint32_t *parent, uint32_t i)
+{
+	while(parent[i] != i)
+	{
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+
+	return(i);
+}
+
+static void track_union(uint32_t *parent, uint32_t a, uint32_t b)
+{
+	/* The earliest run stays the root. */
+	a = track_find(parent, a);
+	b = track_find(parent, b);
+
+	if(a < b) parent[b] = a;
+	else if(b < a) parent[a] = b;
+}
+
+static uint32_t track_runs(tracker_t *t, uint64_t *active, uint32_t rows)
+{
+	/* Splits each row into runs of active cells and joins runs that
+	 * touch one in the row above, diagonals included. */
+	uint32_t n = 0, above = 0, above_end = 0;
+	uint32_t h, x, end = 0, i;
+	uint64_t *row;
+
+	for(h = 0; h < rows; h++)
+	{
+		row = active + h * t->words;
+
+		for(x = track_next(row, t->words, 0, 1); x < t->width;
+		    x = track_next(row, t->words, end, 1))
+		{
+			end = track_next(row, t->words, x, 0);
+			if(end > t->width) end = t->width;
+
+			t->run[n].row   = h;
+			t->run[n].start = x;
+			t->run[n].end   = end;
+			t->parent[n]    = n;
+
+			/* Runs above are in order, so those ending before
+			 * this one can touch no later run either. */
+			while(above < above_end && t->run[above].end < x) above++;
+
+			for(i = above; i < above_end && t->run[i].start <= end; i++)
+				track_union(t->parent, i, n);
+
+			n++;
+		}
+
+		above     = above_end;
+		above_end = n;
+	}
+
+	return(n);
+}
+
+static void track_blobs(tracker_t *t, int *diff, uint32_t runs)
+{
+	/* Gathers the runs into blobs. Once every run points straight
+	 * at its root, the parent of each root holds its blob number. */
+	uint32_t i, x, root, cells, n;
+	track_run_t *r;
+	track_t *b;
+	uint64_t w;
+	int *d;
+
+	for(i = 0; i < runs; i++) t->parent[i] = track_find(t->parent, i);
+
+	t->blobs = 0;
+
+	for(i = 0; i < runs; i++)
+	{
+		r = &t->run[i];
+		root = t->parent[i];
+		cells = r->end - r->start;
+
+		if(root == i)
+		{
+			n = t->blobs;
+			b = &t->blob[n];
+			memset(b, 0, sizeof(track_t));
+			t->weight[n] = 0;
+			t->moment[n] = 0;
+			b->left = r->start;
+			b->right = r->end - 1;
+			b->top = b->bottom = r->row;
+
+			/* Roots are always the first run of their blob. */
+			t->parent[i] = runs + t->blobs++;
+		}
+		else
+		{
+			n = t->parent[root] - runs;
+			b = &t->blob[n];
+			if(r->start < b->left) b->left = r->start;
+			if(r->end - 1 > b->right) b->right = r->end - 1;
+			b->bottom = r->row;
+		}
+
+		/* Each cell's centre * 256, weighted by its difference.
+		 * Cells kept by persistence may not have changed in this
+		 * frame, so each weighs at least 1. */
+		d = diff + r->row * t->width;
+		for(x = r->start; x < r->end; x++)
+		{
+			w = (d[x] > 0 ? d[x] : 1);
+			t->weight[n] += w;
+			t->moment[n] += w * ((x << 8) + 128);
+		}
+
+		b->cells += cells;
+	}
+
+	for(i = 0; i < t->blobs; i++)
+		t->blob[i].centroid = t->moment[i] / t->weight[i];
+}
+
+static int32_t track_distance(track_t *tr, track_t *b, uint64_t captured)
+{
+	/* How far the blob is from where the track should be now. */
+	int64_t dt = captured - tr->seen;
+	int64_t expected = tr->centroid + tr->velocity * dt / 1000000;
+
+	return(llabs(b->centroid - expected));
+}
+
+static void track_match(tracker_t *t, uint64_t captured)
+{
+	/* Repeatedly pairs the closest blob and track within the gate. */
+	uint32_t i, j, bi = 0, bj = 0;
+	int32_t d, best, v;
+	track_t *tr, *b;
+	int64_t dt;
+
+	for(;;)
+	{
+		best = -1;
+
+		for(i = 0; i < t->blobs; i++)
+		{
+			if(t->blob[i].cells < TRACK_MIN_CELLS || t->blob[i].id) continue;
+
+			for(j = 0; j < t->tracks; j++)
+			{
+				if(!t->track[j].missed) continue;
+
+				d = track_distance(&t->track[j], &t->blob[i], captured);
+				if(d > (TRACK_GATE << 8) + ((t->blob[i].right - t->blob[i].left + 1) << 7)) continue;
+				if(best >= 0 && d >= best) continue;
+
+				best = d;
+				bi = i;
+				bj = j;
+			}
+		}
+
+		if(best < 0) break;
+
+		/* Follow the track, averaging its velocity. */
+		tr = &t->track[bj];
+		b  = &t->blob[bi];
+		dt = captured - tr->seen;
+		v  = (dt > 0 ? ((int64_t) b->centroid - tr->centroid) * 1000000 / dt : 0);
+
+		tr->velocity = (tr->age > 1 ? (tr->velocity + v) / 2 : v);
+		tr->centroid = b->centroid;
+		tr->left     = b->left;
+		tr->right    = b->right;
+		tr->top      = b->top;
+		tr->bottom   = b->bottom;
+		tr->cells    = b->cells;
+		tr->seen     = captured;
+		tr->missed   = 0;
+		tr->age++;
+
+		b->id = tr->id;
+	}
+}
+
+uint32_t tracker_update(tracker_t *t, uint64_t *active, int *diff,
+                        uint32_t rows, uint64_t captured)
+{
+	uint32_t i, j, n;
+	track_t tr;
+
+	if(rows > t->height) rows = t->height;
+
+	track_blobs(t, diff, track_runs(t, active, rows));
+
+	/* Every track is unseen until matched. */
+	for(i = 0; i < t->tracks; i++) t->track[i].missed++;
+
+	track_match(t, captured);
+
+	/* Blobs left over start new tracks. */
+	for(i = 0; i < t->blobs && t->tracks < TRACK_MAX; i++)
+	{
+		if(t->blob[i].cells < TRACK_MIN_CELLS || t->blob[i].id) continue;
+
+		t->track[t->tracks] = t->blob[i];
+		t->track[t->tracks].id   = t->next_id++;
+		t->track[t->tracks].age  = 1;
+		t->track[t->tracks].seen = captured;
+		t->tracks++;
+
+		if(!t->next_id) t->next_id = 1;
+	}
+
+	/* Drop the tracks lost for too long, and put the ones to
+	 * report first. */
+	for(i = 0, j = 0; i < t->tracks; i++)
+		if(t->track[i].missed <= TRACK_MISSES) t->track[j++] = t->track[i];
+	t->tracks = j;
+
+	for(i = 0, n = 0; i < t->tracks; i++)
+	{
+		if(t->track[i].missed || t->track[i].age < TRACK_CONFIRM) continue;
+
+		tr = t->track[i];
+		memmove(&t->track[n + 1], &t->track[n], (i - n) * sizeof(track_t));
+		t->track[n++] = tr;
+	}
+
+	return(n);
+}
+
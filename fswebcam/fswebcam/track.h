@@ -0,0 +1,88 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2014 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_TRACK_H
+#define INC_TRACK_H
+
+#include <stdint.h>
+
+/* Groups the cells over the threshold into blobs of touching cells
+ * and follows each blob from frame to frame. */
+#define TRACK_MAX (32)
+
+typedef struct {
+
+	uint16_t id;
+
+	/* Column of the centroid * 256, each cell weighted by how much
+	 * it changed, and the columns and rows the blob covers,
+	 * inclusive. */
+	uint32_t centroid;
+	uint16_t left;
+	uint16_t right;
+	uint16_t top;
+	uint16_t bottom;
+	uint32_t cells;
+
+	/* Columns per second * 256, positive to the right. */
+	int32_t velocity;
+
+	/* Frames since first seen, and since last seen. */
+	uint32_t age;
+	uint32_t missed;
+	uint64_t seen;
+
+} track_t;
+
+typedef struct {
+
+	uint16_t row;
+	uint16_t start;
+	uint16_t end; /* One past the last cell */
+
+} track_run_t;
+
+typedef struct {
+
+	/* Size of the grid. Each row of active cells is a bitset of
+	 * words 64-bit words. */
+	uint32_t width;
+	uint32_t height;
+	uint32_t words;
+
+	/* Runs of active cells in the current frame, the component each
+	 * run belongs to, and the blobs they make up. */
+	track_run_t *run;
+	uint32_t *parent;
+	track_t *blob;
+	uint32_t blobs;
+
+	/* Each blob's total difference, and its sum of differences
+	 * times cell centres * 256. */
+	uint64_t *weight;
+	uint64_t *moment;
+
+	track_t track[TRACK_MAX];
+	uint32_t tracks;
+	uint16_t next_id;
+
+} tracker_t;
+
+extern int tracker_init(tracker_t *t, uint32_t width, uint32_t height);
+extern void tracker_free(tracker_t *t);
+
+/* Finds the blobs in the first rows of the bitset and matches them to
+ * the tracks. diff holds each cell's difference, width cells a row.
+ * Returns the number of tracks seen in this frame, which are moved to
+ * the front of t->track. */
+extern uint32_t tracker_update(tracker_t *t, uint64_t *active, int *diff,
+                               uint32_t rows, uint64_t captured);
+
+#endif
+
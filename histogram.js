@@ -0,0 +1,135 @@
+/*
+ * Log-linear histogram for timing measurements.
+ *
+ * Values (normally microseconds) are sorted into power-of-two ranges, each split
+ * into SUB linear buckets, so relative precision stays around 1/SUB from a few
+ * microseconds up to minutes with a fixed, small bucket array.
+ */
+
+var SUB = 8;
+var RANGES = 32;
+
+var Histogram = function(name, unit)
+{
+    this.name = name;
+    this.unit = unit || 'us';
+    this.buckets = new Uint32Array(RANGES * SUB);
+    this.reset();
+};
+
+Histogram.prototype.reset = function()
+{
+    this.buckets.fill(0);
+    this.count = 0;
+    this.sum = 0;
+    this.min = Infinity;
+    this.max = 0;
+}
+
+Histogram.prototype.record = function(value)
+{
+    if (!(value >= 0)) {
+        return;
+    }
+
+    this.buckets[bucketOf(value)]++;
+    this.count++;
+    this.sum += value;
+    if (value < this.min) this.min = value;
+    if (value > this.max) this.max = value;
+}
+
+Histogram.prototype.percentile = function(p)
+{
+    // Returns the upper edge of the bucket holding the p'th percentile (0 - 100)
+    if (!this.count) {
+        return 0;
+    }
+
+    var rank = Math.ceil(this.count * p / 100);
+    var seen = 0;
+
+    for (var i = 0; i < this.buckets.length; i++) {
+        seen += this.buckets[i];
+        if (seen >= rank) {
+            return Math.min(bucketTop(i), this.max);
+        }
+    }
+    return this.max;
+}
+
+Histogram.prototype.mean = function()
+{
+    return this.count ? this.sum / this.count : 0;
+}
+
+Histogram.prototype.summary = function()
+{
+    if (!this.count) {
+        return this.name + ': no samples';
+    }
+
+    return this.name + ': n=' + this.count +
+        ' min=' + fmt(this.min) + ' mean=' + fmt(this.mean()) +
+        ' p50=' + fmt(this.percentile(50)) + ' p90=' + fmt(this.percentile(90)) +
+        ' p99=' + fmt(this.percentile(99)) + ' max=' + fmt(this.max) + ' ' + this.unit;
+}
+
+Histogram.prototype.report = function(width)
+{
+    // Multi-line text report: the summary followed by one bar per non-empty bucket
+    var lines = [ this.summary() ];
+    var peak = 0;
+
+    width = width || 40;
+
+    for (var i = 0; i < this.buckets.length; i++) {
+        if (this.buckets[i] > peak) peak = this.buckets[i];
+    }
+
+    for (var i = 0; i < this.buckets.length; i++) {
+        var n = this.buckets[i];
+        if (!n) continue;
+
+        var label = ('          ' + fmt(bucketTop(i))).slice(-10);
+        var bar = new Array(Math.max(1, Math.round(n * width / peak)) + 1).join('#');
+        lines.push('  <' + label + ' ' + bar + ' ' + n);
+    }
+
+    return lines.join('\n');
+}
+
+function bucketOf(value)
+{
+    value = Math.floor(value);
+    if (value < SUB) {
+        return value;
+    }
+
+    var range = Math.floor(Math.log2(value)) - Math.log2(SUB) + 1;
+    if (range >= RANGES) {
+        return RANGES * SUB - 1;
+    }
+
+    var base = SUB * Math.pow(2, range - 1);
+    return range * SUB + Math.floor((value - base) / (base / SUB));
+}
+
+function bucketTop(i)
+{
+    var range = Math.floor(i / SUB);
+    if (range == 0) {
+        return i + 1;
+    }
+
+    var base = SUB * Math.pow(2, range - 1);
+    return base + (i % SUB + 1) * (base / SUB);
+}
+
+function fmt(v)
+{
+    return v >= 100 ? String(Math.round(v)) : v.toFixed(1);
+}
+
+
+module.exports = Histogram;
@@ -1,6 +1,7 @@
 #!/usr/bin/env node
 
 var OPC = new require('./opc');
+var Histogram = require('./histogram');
 var fc = new OPC('localhost', 7890);
 fs = require('fs');
 
@@ -51,13 +52,66 @@ var dist_recent = [];
 
 var timerIdle = true;
 
+// Milliseconds between engine ticks.
+var TICK = 30;
+
+// Idle policy: after IDLE_TIMEOUT seconds without sensor activity only one tick in
+// IDLE_DIVISOR is simulated and drawn. 0 disables throttling.
+var IDLE_TIMEOUT = 120;
+var IDLE_DIVISOR = 4;
+
+var lastActivity = Date.now();
+var idleTicks = 0;
+
+// Latency from camera capture to each engine stage, for sensor frames that carry their
+// capture time ( fswebcam --framed ). Reported every LATENCY_REPORT seconds, 0 disables.
+var LATENCY_REPORT = 0;
+var latency = {
+	'receive': new Histogram('capture to engine'),
+	'spawn': new Histogram('capture to spawn'),
+	'write': new Histogram('capture to OPC write')
+};
+var spawnedFrame = null;
+
+// Calibration: for CALIBRATE seconds after the sensor opens the strip flashes white
+// every CALIBRATE_FLASH ms while fswebcam, told over its control socket
+// ( fswebcam --control ), learns which cells see the strip. 0 disables.
+var CONTROL = null;
+var CALIBRATE = 0;
+var CALIBRATE_FLASH = 500;
+var calibratingUntil = 0;
+
+// Position table: [ camera column, strip position ] pairs recorded in a walk-through, so
+// tracked visitors land where they stand despite lens distortion and the camera's
+// angle. table=<file> loads one and walk=<file> records one: a marker lights at
+// WALK_POINTS places along the strip in turn, and whoever waves or sways under each,
+// staying within WALK_SPREAD columns for WALK_HOLD ms, marks the column fswebcam sees
+// them at ( needs fswebcam --track ). Without a table columns map evenly onto the strip.
+var TABLE = null;
+var WALK = null;
+var WALK_POINTS = 8;
+var WALK_HOLD = 2000;
+var WALK_SPREAD = 1;
+var positionTable = null;
+var walk = null;
+
+// Prediction: each tracked visitor's position and velocity are smoothed with an
+// alpha-beta filter, and particles spawn where the visitor will be once the strip shows
+// them. The lead is the age of the track frame plus the measured time from spawning a
+// particle to writing it out, capped at PREDICT_MAX ms. predict=0 turns it off.
+var PREDICT = true;
+var PREDICT_ALPHA = 0.5;
+var PREDICT_BETA = 0.2;
+var PREDICT_MAX = 250;
+var predictors = {};
+
 
 ///////////
 // MAIN COMPUTER PROGRAM!
 ///////////
 
 initialize();
-setInterval(evaluate, 30);
+setInterval(evaluate, TICK);
 
 function initialize() {
 
@@ -71,11 +125,38 @@ function initialize() {
 				if ( current == "sensorTest" ) { SENSORTEST = true; }
 				else if ( current == "positionTest" ) { POSITIONTEST = true; }
 				else if ( current == "noSensors") { USESENSOR = false; }
+				else if ( current.indexOf("opc=") == 0 ) {
+					// opc=host:port, or opc=/path/to/socket for a local OPC sink
+					var target = current.substring(4).split(':');
+					fc = new OPC( target[0], target.length > 1 ? parseInt( target[1] ) : undefined );
+				}
+				else if ( current.indexOf("idle=") == 0 ) { IDLE_TIMEOUT = parseFloat( current.substring(5) ); }
+				else if ( current.indexOf("latency=") == 0 ) { LATENCY_REPORT = parseFloat( current.substring(8) ); }
+				else if ( current.indexOf("control=") == 0 ) { CONTROL = current.substring(8); }
+				else if ( current.indexOf("calibrate=") == 0 ) { CALIBRATE = parseFloat( current.substring(10) ); }
+				else if ( current.indexOf("table=") == 0 ) { TABLE = current.substring(6); }
+				else if ( current.indexOf("walk=") == 0 ) { WALK = current.substring(5); }
+				else if ( current.indexOf("predict=") == 0 ) { PREDICT = parseFloat( current.substring(8) ) != 0; }
 			}
 	}
 
+	if ( LATENCY_REPORT > 0 ) {
+		setInterval( reportLatency, LATENCY_REPORT * 1000 );
+	}
+
+	// fcserver holds the last frame, so identical frames need not be resent
+	fc.skipUnchanged = true;
+
 	sensorCount = sensor.initialize( dist_v, context );
 
+	if ( TABLE ) {
+		try {
+			setPositionTable( JSON.parse( fs.readFileSync( TABLE, 'utf8' ) ) );
+		} catch( err ) {
+			console.log( 'position table: ' + err.message );
+		}
+	}
+
 	for ( var i=0; i < sensorCount; i++ ) { dist_v[i] = 0; }
 
 	// Init coord lookup
@@ -105,6 +186,9 @@ function initialize() {
 
 function evaluate() {
 	if ( context.runState == "open") {
+		if ( calibrating() ) { return; }
+		if ( walking() ) { return; }
+		if ( throttled() ) { return; }
 		evaluateEnvironment();
   	updateParticles();
   	draw();
@@ -120,6 +204,217 @@ function evaluate() {
 }
 
 
+// Returns true when this tick should be skipped because nobody has been seen for a
+// while. The sensor is still read on skipped ticks, so new motion brings back the
+// full rate on the tick it arrives.
+function throttled() {
+	var now = Date.now();
+
+	if ( sensorActive() ) { lastActivity = now; }
+
+	if ( !IDLE_TIMEOUT || now - lastActivity < IDLE_TIMEOUT * 1000 ) {
+		idleTicks = 0;
+		return false;
+	}
+
+	if ( ++idleTicks % IDLE_DIVISOR == 0 ) { return false; }
+
+	sensor.update( dist_v );
+	if ( sensorActive() ) {
+		lastActivity = now;
+		idleTicks = 0;
+		return false;
+	}
+
+	return true;
+}
+
+// Returns true while the strip is flashing for calibration. The sensor is still drained,
+// but what it sees is the strip, so nothing is spawned.
+function calibrating() {
+	var now = Date.now();
+
+	if ( CALIBRATE > 0 ) {
+		startCalibration( CALIBRATE );
+		calibratingUntil = now + CALIBRATE * 1000;
+		CALIBRATE = 0;
+	}
+	if ( !calibratingUntil ) { return false; }
+
+	if ( now >= calibratingUntil ) {
+		calibratingUntil = 0;
+		console.log( 'calibration done' );
+		return false;
+	}
+
+	sensor.update( dist_v );
+	for ( var s=0; s < sensorCount; s++ ) { dist_v[s] = 0; }
+	if ( sensor.tracks ) { sensor.tracks = []; }
+	lastActivity = now;
+
+	var level = Math.floor( now / CALIBRATE_FLASH ) % 2 ? 255 : 0;
+	initAllPixels( level, level, level );
+	for ( var i=0; i<pixels.length; i++ ){
+		fc.setPixel( pixels.length-i, pixels[i].red, pixels[i].green, pixels[i].blue );
+	}
+	fc.writePixels();
+
+	return true;
+}
+
+// Asks fswebcam to learn a mask for the given number of seconds.
+function startCalibration( seconds ) {
+	if ( !CONTROL ) {
+		console.log( 'calibration needs control=<fswebcam control socket>' );
+		return;
+	}
+
+	var socket = require('net').createConnection( CONTROL );
+	socket.on('connect', function() {
+		socket.end( 'calibrate ' + Math.ceil( seconds ) + '\n' );
+	});
+	socket.on('data', function( reply ) {
+		console.log( 'fswebcam: ' + reply.toString().trim() );
+	});
+	socket.on('error', function( err ) {
+		console.log( 'calibration: ' + err.message );
+	});
+	console.log( 'calibrating for ' + seconds + ' seconds' );
+}
+
+// Uses a table of [ column, position ] pairs, ignoring points that repeat a column.
+function setPositionTable( table ) {
+	var points = table.filter( function( p ) {
+		return p.length == 2 && isFinite( p[0] ) && isFinite( p[1] );
+	}).sort( function( a, b ) { return a[0] - b[0]; });
+
+	positionTable = [];
+	for ( var i=0; i < points.length; i++ ) {
+		if ( !i || points[i][0] > points[i-1][0] ) { positionTable.push( points[i] ); }
+	}
+
+	if ( positionTable.length < 2 ) {
+		console.log( 'position table needs at least two columns' );
+		positionTable = null;
+		return;
+	}
+
+	if ( sensor.mapPositions ) { sensor.mapPositions(); }
+	console.log( 'position table of ' + positionTable.length + ' points' );
+}
+
+// Strip position of a camera column, of columns across the picture, and how far along
+// the strip one column moves there. Between the points of the table positions are
+// interpolated, and past its ends the nearest segment is carried on.
+function columnOffset( column, columns ) {
+	if ( !positionTable ) {
+		return environmentLength - 1 - column * ( environmentLength - 1 ) / columns;
+	}
+
+	var t = positionTable;
+	var i = 1;
+	while ( i < t.length - 1 && column > t[i][0] ) { i++; }
+
+	return t[i-1][1] + ( column - t[i-1][0] ) * ( t[i][1] - t[i-1][1] ) / ( t[i][0] - t[i-1][0] );
+}
+
+function columnPosition( column, columns ) {
+	var p = Math.floor( columnOffset( column, columns ) );
+	return p < 0 ? 0 : p > environmentLength - 1 ? environmentLength - 1 : p;
+}
+
+function columnSlope( column, columns ) {
+	return columnOffset( column + 0.5, columns ) - columnOffset( column - 0.5, columns );
+}
+
+// Records the position table while walk= is set. Returns true while walking, when
+// nothing is spawned and the strip shows only the marker, green once the visitor under
+// it is being timed. Frames where they are not seen, having kept too still, are passed
+// over.
+function walking() {
+	if ( !WALK ) { return false; }
+
+	var now = Date.now();
+	if ( !walk ) {
+		walk = { 'point': 0, 'since': 0, 'count': 0, 'sum': 0, 'table': [], 'frame': null };
+		console.log( 'walk-through: wave under each marker in turn' );
+	}
+
+	sensor.update( dist_v );
+	for ( var s=0; s < sensorCount; s++ ) { dist_v[s] = 0; }
+	lastActivity = now;
+
+	var target = Math.floor( ( walk.point + 0.5 ) * ( environmentLength - 1 ) / WALK_POINTS );
+	var tracks = sensor.tracks;
+
+	// Only new track frames count, as ticks come faster than frames.
+	var seen = false;
+	if ( sensor.frame && sensor.frame !== walk.frame && tracks && tracks.length ) {
+		walk.frame = sensor.frame;
+		seen = true;
+
+		// Until they have moved on from the last marker, they are not under this one.
+		var column = tracks[0].column;
+		var last = walk.table.length ? walk.table[walk.table.length - 1][0] : -1;
+		var moved = last < 0 || Math.abs( column - last ) > WALK_SPREAD;
+
+		if ( tracks.length > 1 || !moved || ( walk.count && Math.abs( column - walk.sum / walk.count ) > WALK_SPREAD ) ) {
+			walk.since = 0;
+			walk.count = 0;
+			walk.sum = 0;
+		}
+		if ( tracks.length == 1 && moved ) {
+			if ( !walk.since ) { walk.since = now; }
+			walk.count++;
+			walk.sum += column;
+		}
+	}
+
+	if ( seen && walk.since && now - walk.since >= WALK_HOLD ) {
+		var mean = walk.sum / walk.count;
+		walk.table.push( [ mean, target ] );
+		console.log( 'walk-through: ' + target + ' at column ' + mean.toFixed( 2 ) );
+
+		walk.point++;
+		walk.since = 0;
+		walk.count = 0;
+		walk.sum = 0;
+
+		if ( walk.point == WALK_POINTS ) {
+			fs.writeFileSync( WALK, JSON.stringify( walk.table ) );
+			console.log( 'walk-through saved to ' + WALK );
+			setPositionTable( walk.table );
+			if ( sensor.tracks ) { sensor.tracks = []; }
+			WALK = null;
+			walk = null;
+			return false;
+		}
+	}
+
+	initAllPixels( 0, 0, 0 );
+	var dest = coordT[target];
+	for ( var d=dest-1; d <= dest+1; d++ ) {
+		if ( d >= 0 && d < pixelLength ) { setPixel( d, walk.since ? 0 : 255, 255, walk.since ? 0 : 255 ); }
+	}
+	for ( var i=0; i<pixels.length; i++ ){
+		fc.setPixel( pixels.length-i, pixels[i].red, pixels[i].green, pixels[i].blue );
+	}
+	fc.writePixels();
+
+	return true;
+}
+
+// With fswebcam --sparse, only the sensors listed in the last frame can be set.
+function sensorActive() {
+	if ( sensor.tracks && sensor.tracks.length ) { return true; }
+	var n = sensor.active ? sensor.active.length : sensorCount;
+	for ( var i=0; i < n; i++ ) {
+		var s = sensor.active ? sensor.active[i] : i;
+		if ( dist_v[s] > 0 && dist_v[s] < 150 ) { return true; }
+	}
+	return false;
+}
+
 function updateParticles() {
   for ( var i=0; i<particles.length; i++ ){
 		particles[i].update( i );
@@ -137,10 +432,27 @@ function evaluateEnvironment() {
 		addParticle( getRandParticle() );
 	}
 
-	for ( var s=0; s < sensorCount; s++ ) {
-			if ( dist_v[s] > 0 && dist_v[s] < 150 ) {
-				particles.push( getProximateParticle( s, dist_v[s] ));
-			}
+	var frame = sensor.frame;
+	var spawned = false;
+	if ( sensor.tracks ) {
+		// fswebcam --track: one emitter per visitor
+		for ( var t=0; t < sensor.tracks.length; t++ ) {
+			particles.push( getTrackParticle( sensor.tracks[t] ));
+			spawned = true;
+		}
+	} else {
+		var n = sensor.active ? sensor.active.length : sensorCount;
+		for ( var i=0; i < n; i++ ) {
+				var s = sensor.active ? sensor.active[i] : i;
+				if ( dist_v[s] > 0 && dist_v[s] < 150 ) {
+					particles.push( getProximateParticle( s, dist_v[s] ));
+					spawned = true;
+				}
+		}
+	}
+	if ( spawned ) {
+		traceFrame( frame, 'spawn' );
+		spawnedFrame = frame;
 	}
 
 	sensor.update( dist_v );
@@ -170,7 +482,7 @@ function draw() {
 	    for ( var i=0; i<pixels.length; i++ ){
 	      fc.setPixel( pixels.length-i, pixels[i].red, pixels[i].green, pixels[i].blue );
 	    }
-	    fc.writePixels();
+	    if ( fc.writePixels() ) { traceFrame( spawnedFrame, 'write' ); }
 	//	} catch( err ) {
 	//		console.log('fc write err: ' + error);
 	//		context.runState = "fc write err";
@@ -184,6 +496,30 @@ function draw() {
 
 
 
+// Records how long after capture a sensor frame reached a stage, once per frame and stage
+function traceFrame( frame, stage ) {
+	if ( !frame || frame[stage] ) { return; }
+
+	frame[stage] = true;
+	latency[stage].record( monotonicMicros() - frame.captured );
+}
+
+function reportLatency() {
+	for ( var stage in latency ) {
+		console.log( latency[stage].summary() );
+		latency[stage].reset();
+	}
+}
+
+// Microseconds on the monotonic clock, the same one fswebcam timestamps frames with
+function monotonicMicros() {
+	var t = process.hrtime();
+	return t[0] * 1000000 + t[1] / 1000;
+}
+
+
+
+
 ///////////
 // particle methods
 ///////////
@@ -343,7 +679,68 @@ function getProximateParticle( s, dist ) {
 	//Math.floor( ( s + 1 ) * ( environmentLength / sensorCount ) );
 	var life = 150 - dist;
 
-	return getParticle( 4, pos, 1,  method_BrightenSmooth, update_React, defaultScale, 85, 55, 15, life );
+	var vel = sensor.getVelocity ? sensor.getVelocity( s ) : 0;
+
+	return getParticle( particleVelocity( vel ), pos, 1,  method_BrightenSmooth, update_React, defaultScale, 85, 55, 15, life );
+}
+
+// Particle velocity per tick for a visitor moving at the given environment units per
+// second. Visitors standing still, or without a measured velocity, emit as before.
+function particleVelocity( unitsPerSecond ) {
+	var vel = Math.round( unitsPerSecond * TICK / 1000 );
+	if ( vel == 0 ) { vel = 4; }
+	if ( vel > 20 ) { vel = 20; }
+	if ( vel < -20 ) { vel = -20; }
+	return vel;
+}
+
+// A particle from a tracked visitor, moving along with them.
+function getTrackParticle( track ) {
+	return getParticle( particleVelocity( track.velocity ), predictPosition( track ), 1,  method_BrightenSmooth, update_React, defaultScale, 85, 55, 15, 150 - track.bottom );
+}
+
+// Follows each track with its own filter, captured being the frame's capture time, and
+// forgets the tracks no longer reported. The track's velocity becomes the smoothed one.
+function predictTracks( tracks, captured ) {
+	var seen = {};
+
+	for ( var i=0; i < tracks.length; i++ ) {
+		var track = tracks[i];
+		var p = predictors[track.id];
+
+		if ( !p ) {
+			p = predictors[track.id] = { 'x': track.position, 'v': track.velocity, 't': captured };
+		} else {
+			var dt = ( captured - p.t ) / 1000000;
+			if ( dt > 0 ) {
+				var x = p.x + p.v * dt;
+				var r = track.position - x;
+				p.x = x + PREDICT_ALPHA * r;
+				p.v = p.v + PREDICT_BETA * r / dt;
+				p.t = captured;
+			}
+		}
+
+		track.predictor = p;
+		track.velocity = p.v;
+		seen[track.id] = true;
+	}
+
+	for ( var id in predictors ) {
+		if ( !seen[id] ) { delete predictors[id]; }
+	}
+}
+
+// Where a tracked visitor will be by the time a particle spawned now is on the strip.
+function predictPosition( track ) {
+	var p = track.predictor;
+	if ( !PREDICT || !p ) { return track.position; }
+
+	var lead = monotonicMicros() - p.t + Math.max( 0, latency.write.percentile( 50 ) - latency.spawn.percentile( 50 ) );
+	lead = Math.min( lead, PREDICT_MAX * 1000 ) / 1000000;
+
+	var x = Math.floor( p.x + p.v * lead );
+	return x < 0 ? 0 : x > environmentLength - 1 ? environmentLength - 1 : x;
 }
 
 function getRandParticle() {
@@ -395,13 +792,48 @@ function getParticle( v, p, i, m, u, s, r, g, b, l ) {
 function visualSensors(){
 	var self = this;
 	self.positions = [];
-	self.delimiter = String.fromCharCode(254);
 	self.readable = false;
+	self.pending = null;
+	self.frame = null;
+
+	// fswebcam writes either legacy records, 35 ( row, diff ) column pairs followed by
+	// DELIMITER, or with --framed, frames of SYNC, a type byte, a little-endian 16-bit
+	// payload length and the payload. SYNC never appears in a legacy record.
+	self.DELIMITER = 254;
+	self.SYNC = 255;
+	self.FRAME_COLUMNS = 1;
+	self.FRAME_STATUS = 2;
+	self.FRAME_TRACKS = 3;
+	self.FRAME_GLOBAL = 4;
+	self.FRAME_SPARSE = 5;
+	self.FRAME_HEARTBEAT = 6;
+	self.TRACK_SIZE = 14;
+
+	// With fswebcam --track, the visitors in the last frame, null until a track frame
+	// arrives.
+	self.tracks = null;
+
+	// With fswebcam --flow, each sensor's horizontal velocity in environment units per
+	// second, from the columns after the ( row, diff ) pairs.
+	self.flow = [];
+
+	// Status frames say when fswebcam has lost the camera and is reconnecting.
+	self.STATUS_OK = 0;
+	self.STATUS_DEGRADED = 1;
+	self.degraded = false;
+
+	// With fswebcam --global, frames where most of the picture changed at once come as
+	// global frames in place of columns or tracks.
+	self.lighting = false;
+
+	// With fswebcam --sparse, frames list only the active columns, and while they stay
+	// the same only a heartbeat comes about once a second. The sensors the last one set,
+	// null until a sparse frame arrives.
+	self.active = null;
 
 
 	self.initialize = function( dist_v, context ) {
 
-		process.stdin.setEncoding('utf8');
 	  process.stdin.on('readable', function() {
 	    self.readable = true;
 	  });
@@ -428,23 +860,243 @@ function visualSensors(){
 		if ( self.readable ) {
 	    var chunk = process.stdin.read();
 	    if (chunk !== null) {
-	      var arr = [];
+	      self.pending = self.pending ? Buffer.concat([ self.pending, chunk ]) : chunk;
 
-	      var sub = chunk.substring(0,71);
-	      var segments = sub.split( self.delimiter );
-
-	      var rebuilt = segments[0];
-
-	      for ( var t=0; t < 35; t++ ){
-	          dist_v[35-t] = rebuilt[t*2].charCodeAt();
+	      if ( self.parse( dist_v ) ) {
+					//console.log('\033[0;0H');
+	        self.writeGrid( dist_v );
 	      }
-
-				//console.log('\033[0;0H');
-	      self.writeGrid( dist_v );
 	    }
 	  }
 	}
 
+	// Applies every complete record or frame in the pending input, oldest first, and
+	// keeps any partial one for the next read. Returns true if dist_v was updated.
+	self.parse = function( dist_v ) {
+		var data = self.pending;
+		var offset = 0;
+		var updated = false;
+
+		while ( offset < data.length ) {
+			if ( data[offset] == self.SYNC ) {
+				if ( data.length - offset < 4 ) { break; }
+
+				var length = data.readUInt16LE( offset + 2 );
+				if ( data.length - offset < 4 + length ) { break; }
+
+				updated = self.readFrame( data[offset + 1], data.slice( offset + 4, offset + 4 + length ), dist_v ) || updated;
+				offset += 4 + length;
+			} else {
+				// Legacy record. Anything before its last 70 bytes is noise, and a frame
+				// header part way through means the record was cut short.
+				var end = offset;
+				while ( end < data.length && data[end] != self.DELIMITER && data[end] != self.SYNC ) { end++; }
+				if ( end == data.length ) { break; }
+
+				if ( data[end] == self.DELIMITER ) {
+					if ( end - offset >= 70 ) {
+						self.frame = null;
+						self.active = null;
+						self.setColumns( data, end - 70, dist_v );
+						updated = true;
+					}
+					end++;
+				}
+				offset = end;
+			}
+		}
+
+		self.pending = offset < data.length ? data.slice( offset ) : null;
+
+		// Never buffer more than a few frames of unparseable input
+		if ( self.pending && self.pending.length > 4096 ) { self.pending = null; }
+
+		return updated;
+	}
+
+	self.readFrame = function( type, payload, dist_v ) {
+		if ( type == self.FRAME_STATUS && payload.length >= 13 ) {
+			return self.readStatus( payload[0], payload.readUInt32LE( 1 ), dist_v );
+		}
+		if ( type == self.FRAME_GLOBAL && payload.length >= 21 ) {
+			return self.readGlobal( payload, dist_v );
+		}
+		if ( type == self.FRAME_TRACKS && payload.length >= 23 ) {
+			self.lighting = false;
+			return self.readTracks( payload );
+		}
+		if ( type == self.FRAME_SPARSE && payload.length >= 25 ) {
+			self.lighting = false;
+			return self.readSparse( payload, dist_v );
+		}
+		if ( type == self.FRAME_HEARTBEAT && payload.length >= 20 ) {
+			self.frame = {
+				'seq': payload.readUInt32LE( 0 ),
+				'captured': payload.readUInt32LE( 4 ) + payload.readUInt32LE( 8 ) * 4294967296
+			};
+			latency.receive.record( monotonicMicros() - self.frame.captured );
+			return false;
+		}
+		if ( type != self.FRAME_COLUMNS || payload.length < 20 + 70 ) { return false; }
+		self.lighting = false;
+		self.active = null;
+
+		self.frame = {
+			'seq': payload.readUInt32LE( 0 ),
+			'captured': payload.readUInt32LE( 4 ) + payload.readUInt32LE( 8 ) * 4294967296
+		};
+		latency.receive.record( monotonicMicros() - self.frame.captured );
+
+		self.setColumns( payload, 20, dist_v );
+		if ( payload.length >= 20 + 70 + 70 ) { self.setFlow( payload, 20 + 70 ); }
+		return true;
+	}
+
+	// Track centroids are in camera columns * 256 and velocities in columns per second
+	// * 256, both mapped onto the strip through the position table.
+	self.readTracks = function( payload ) {
+		var columns = payload.readUInt16LE( 20 );
+		var count = payload[22];
+
+		self.frame = {
+			'seq': payload.readUInt32LE( 0 ),
+			'captured': payload.readUInt32LE( 4 ) + payload.readUInt32LE( 8 ) * 4294967296
+		};
+		latency.receive.record( monotonicMicros() - self.frame.captured );
+
+		self.tracks = [];
+		for ( var i=0; i < count && 23 + ( i + 1 ) * self.TRACK_SIZE <= payload.length; i++ ) {
+			var o = 23 + i * self.TRACK_SIZE;
+			var column = payload.readUInt16LE( o + 2 ) / 256;
+			var velocity = payload.readInt16LE( o + 8 ) / 256;
+			self.tracks.push({
+				'id': payload.readUInt16LE( o ),
+				'column': column,
+				'position': columnPosition( column, columns ),
+				'bottom': payload[o + 7],
+				'columnVelocity': velocity,
+				'velocity': velocity * columnSlope( column, columns ),
+				'age': payload.readUInt16LE( o + 10 )
+			});
+		}
+		if ( PREDICT ) { predictTracks( self.tracks, self.frame.captured ); }
+		return true;
+	}
+
+	// Only the sensors the last sparse frame set and the ones this one lists are touched.
+	// Wider grids are folded onto the sensors, each keeping the lowest row of its columns,
+	// which come in order.
+	self.readSparse = function( payload, dist_v ) {
+		var columns = payload.readUInt16LE( 20 );
+		var count = payload.readUInt16LE( 22 );
+		var size = payload[24];
+
+		self.frame = {
+			'seq': payload.readUInt32LE( 0 ),
+			'captured': payload.readUInt32LE( 4 ) + payload.readUInt32LE( 8 ) * 4294967296
+		};
+		latency.receive.record( monotonicMicros() - self.frame.captured );
+
+		if ( self.active ) {
+			for ( var i=0; i < self.active.length; i++ ) {
+				dist_v[self.active[i]] = 0;
+				self.flow[self.active[i]] = 0;
+			}
+		} else {
+			for ( var s=0; s < dist_v.length; s++ ) { dist_v[s] = 0; }
+			self.flow = [];
+		}
+
+		self.active = [];
+		if ( !columns || size < 4 ) { return true; }
+
+		for ( var i=0; i < count && 25 + ( i + 1 ) * size <= payload.length; i++ ) {
+			var o = 25 + i * size;
+			var column = payload.readUInt16LE( o );
+			var s = 35 - ( columns == 35 ? column : Math.floor( column * 35 / columns ));
+			if ( s < 1 || s >= sensorCount ) { continue; }
+
+			if ( self.active[self.active.length - 1] !== s ) {
+				self.active.push( s );
+				dist_v[s] = payload[o + 2];
+			} else if ( payload[o + 2] > dist_v[s] ) {
+				dist_v[s] = payload[o + 2];
+			}
+			if ( size >= 6 ) {
+				self.flow[s] = payload.readInt16LE( o + 4 ) / 256 * columnSlope( column + 0.5, columns );
+			}
+		}
+		return true;
+	}
+
+	// A change in the lighting would have every column spawn particles at once, so the
+	// columns are cleared as they are while the camera is away.
+	self.readGlobal = function( payload, dist_v ) {
+		self.frame = {
+			'seq': payload.readUInt32LE( 0 ),
+			'captured': payload.readUInt32LE( 4 ) + payload.readUInt32LE( 8 ) * 4294967296
+		};
+		latency.receive.record( monotonicMicros() - self.frame.captured );
+
+		if ( !self.lighting ) {
+			console.log( 'lighting changed, ' + payload[20] + '% of the picture' );
+		}
+		self.lighting = true;
+
+		for ( var s=0; s < dist_v.length; s++ ) { dist_v[s] = 0; }
+		if ( self.tracks ) { self.tracks = []; }
+		if ( self.active ) { self.active = []; }
+		self.flow = [];
+		return true;
+	}
+
+	// While the camera is away the last columns would keep spawning particles, so they
+	// are cleared and the environment carries on with its ambient particles.
+	self.readStatus = function( status, attempts, dist_v ) {
+		var degraded = ( status == self.STATUS_DEGRADED );
+
+		if ( degraded && !self.degraded ) {
+			console.log( 'camera lost, fswebcam is reconnecting' );
+		} else if ( !degraded && self.degraded ) {
+			console.log( 'camera back after ' + attempts + ' attempts' );
+		}
+		self.degraded = degraded;
+
+		if ( !degraded ) { return false; }
+
+		self.frame = null;
+		for ( var s=0; s < dist_v.length; s++ ) { dist_v[s] = 0; }
+		if ( self.tracks ) { self.tracks = []; }
+		if ( self.active ) { self.active = []; }
+		self.flow = [];
+		return true;
+	}
+
+	self.setColumns = function( data, offset, dist_v ) {
+		for ( var t=0; t < 35; t++ ){
+			dist_v[35-t] = data[offset + t*2];
+		}
+	}
+
+	// Velocities are in camera columns per second * 256, and columns run the opposite
+	// way to the strip.
+	self.setFlow = function( data, offset ) {
+		for ( var t=0; t < 35; t++ ){
+			self.flow[35-t] = data.readInt16LE( offset + t*2 ) / 256 * columnSlope( t + 0.5, 35 );
+		}
+	}
+
+	// With a position table, each column's particles spawn at the middle of the column.
+	self.mapPositions = function() {
+		for ( var t=0; t < 35; t++ ){
+			self.positions[35-t] = columnPosition( t + 0.5, 35 );
+		}
+	}
+
+	self.getVelocity = function( p ) {
+		return self.flow[p] || 0;
+	}
+
 	self.getPosition = function( p ) {
 		if ( p < 0 || p >= self.positions.length ) {
 			return 0;
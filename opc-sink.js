@@ -0,0 +1,206 @@
+#!/usr/bin/env node
+
+/*
+ * Loopback Open Pixel Control sink.
+ *
+ * Stands in for fcserver when no FadeCandy is attached: accepts OPC clients on a
+ * TCP port or a Unix socket, checks every message header and length, and keeps
+ * statistics on frame arrival times, throughput and gaps.
+ *
+ *   node opc-sink.js [port | /path/to/socket] [options]
+ *
+ *   --pixels <n>     Expected pixel count per frame (reports mismatches)
+ *   --fps <rate>     Expected frame rate; arrivals later than 2 periods count as gaps
+ *   --gap <ms>       Explicit gap threshold, overrides the one derived from --fps
+ *   --interval <s>   Seconds between periodic reports (0 = only on exit)
+ *   --histogram      Include the full inter-frame histogram in periodic reports
+ */
+
+var net = require('net');
+var fs = require('fs');
+var Histogram = require('./histogram');
+
+var OPC_SET_PIXELS = 0;
+var OPC_SYSEX = 255;
+
+var options = {
+    listen: 7890,
+    pixels: 0,
+    fps: 0,
+    gap: 0,
+    interval: 10,
+    histogram: false
+};
+
+var stats = {
+    started: now(),
+    frames: 0,
+    bytes: 0,
+    sysex: 0,
+    invalid: 0,
+    mismatched: 0,
+    gaps: 0,
+    longestGap: 0,
+    clients: 0,
+    lastFrame: 0,
+    interval: new Histogram('inter-frame'),
+    windowFrames: 0,
+    windowBytes: 0,
+    windowStart: now()
+};
+
+
+parseArguments(process.argv.slice(2));
+listen();
+
+
+function parseArguments(args) {
+    for (var i = 0; i < args.length; i++) {
+        var arg = args[i];
+
+        if (arg == '--pixels') { options.pixels = parseInt(args[++i]); }
+        else if (arg == '--fps') { options.fps = parseFloat(args[++i]); }
+        else if (arg == '--gap') { options.gap = parseFloat(args[++i]) * 1000; }
+        else if (arg == '--interval') { options.interval = parseFloat(args[++i]); }
+        else if (arg == '--histogram') { options.histogram = true; }
+        else if (/^\d+$/.test(arg)) { options.listen = parseInt(arg); }
+        else { options.listen = arg; }
+    }
+
+    if (!options.gap && options.fps) {
+        options.gap = 2 * 1000000 / options.fps;
+    }
+}
+
+function listen() {
+    var server = net.createServer(accept);
+
+    if (typeof options.listen == 'string' && fs.existsSync(options.listen)) {
+        // Remove a socket left behind by a previous run, but nothing else
+        if (!fs.lstatSync(options.listen).isSocket()) {
+            console.log('OPC sink error: ' + options.listen + ' exists and is not a socket');
+            process.exit(1);
+        }
+        fs.unlinkSync(options.listen);
+    }
+
+    server.listen(options.listen, function() {
+        console.log('OPC sink listening on ' + options.listen);
+    });
+
+    server.on('error', function(error) {
+        console.log('OPC sink error: ' + error);
+        process.exit(1);
+    });
+
+    if (options.interval > 0) {
+        setInterval(function() { report(options.histogram); }, options.interval * 1000);
+    }
+
+    process.on('SIGINT', shutdown);
+    process.on('SIGTERM', shutdown);
+
+    function shutdown() {
+        report(true);
+        server.close();
+        process.exit(0);
+    }
+}
+
+function accept(socket) {
+    var pending = null;
+
+    stats.clients++;
+    console.log('Client connected (' + stats.clients + ' total)');
+
+    socket.setNoDelay();
+
+    socket.on('data', function(chunk) {
+        var arrival = now();
+        var data = pending ? Buffer.concat([ pending, chunk ]) : chunk;
+        var offset = 0;
+
+        // Consume every complete message in the buffer
+        while (data.length - offset >= 4) {
+            var channel = data[offset];
+            var command = data[offset + 1];
+            var length = data.readUInt16BE(offset + 2);
+
+            if (data.length - offset < 4 + length) {
+                break;
+            }
+
+            message(channel, command, length, arrival);
+            offset += 4 + length;
+        }
+
+        pending = offset < data.length ? data.slice(offset) : null;
+    });
+
+    socket.on('close', function() {
+        if (pending) {
+            console.log('Client closed with ' + pending.length + ' bytes of a partial message');
+            stats.invalid++;
+        }
+        console.log('Client disconnected');
+    });
+
+    socket.on('error', function(error) {
+        console.log('Client error: ' + error);
+    });
+}
+
+function message(channel, command, length, arrival) {
+    stats.bytes += 4 + length;
+    stats.windowBytes += 4 + length;
+
+    if (command == OPC_SYSEX) {
+        stats.sysex++;
+        return;
+    }
+
+    if (command != OPC_SET_PIXELS || length % 3 != 0) {
+        stats.invalid++;
+        return;
+    }
+
+    if (options.pixels && length / 3 != options.pixels) {
+        stats.mismatched++;
+    }
+
+    if (stats.lastFrame) {
+        var delta = arrival - stats.lastFrame;
+
+        stats.interval.record(delta);
+        if (delta > stats.longestGap) stats.longestGap = delta;
+        if (options.gap && delta > options.gap) stats.gaps++;
+    }
+
+    stats.lastFrame = arrival;
+    stats.frames++;
+    stats.windowFrames++;
+}
+
+function report(full) {
+    var t = now();
+    var window = (t - stats.windowStart) / 1000000;
+    var total = (t - stats.started) / 1000000;
+
+    console.log('--- OPC sink: ' + stats.frames + ' frames in ' + total.toFixed(1) + ' s');
+    console.log('rate: ' + (stats.windowFrames / window).toFixed(1) + ' fps, ' +
+        (stats.windowBytes / window / 1024).toFixed(1) + ' KiB/s (last ' + window.toFixed(1) + ' s)');
+    console.log('messages: sysex=' + stats.sysex + ' invalid=' + stats.invalid +
+        ' length mismatches=' + stats.mismatched);
+    console.log('gaps: ' + stats.gaps + (options.gap ? ' over ' + (options.gap / 1000).toFixed(1) + ' ms' : '') +
+        ', longest ' + (stats.longestGap / 1000).toFixed(1) + ' ms');
+    console.log(full ? stats.interval.report() : stats.interval.summary());
+
+    stats.windowFrames = 0;
+    stats.windowBytes = 0;
+    stats.windowStart = t;
+}
+
+function now() {
+    var t = process.hrtime();
+    return t[0] * 1000000 + t[1] / 1000;
+}
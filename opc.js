@@ -8,16 +8,37 @@
 var net = require('net');
 var fs = require('fs');
 
+// Milliseconds to wait before reconnecting to fcserver, doubled after each
+// failed attempt.
+var RECONNECT_MIN = 250;
+var RECONNECT_MAX = 16000;
+
 
 /********************************************************************************
  * Core OPC Client
  */
 
-var OPC = function(host, port)
+var OPC = function(host, port, buffers)
 {
+    // A host with no port is taken as the path of a Unix socket.
+    // "buffers" is the number of packet buffers rotated between frames (default 2).
     this.host = host;
     this.port = port;
     this.pixelBuffer = null;
+    this.bufferCount = Math.max(2, buffers || 2);
+    this.freeBuffers = [];
+    this.generation = 0;
+    this.framesDropped = 0;
+
+    // When set, frames identical to the last one sent are not written again
+    // (fcserver keeps showing the last frame it received).
+    this.skipUnchanged = false;
+    this.lastHash = null;
+    this.framesSkipped = 0;
+
+    // While fcserver is unreachable, no new connection is tried before retryAt.
+    this.retryAt = 0;
+    this.retryWait = RECONNECT_MIN;
 };
 
 OPC.prototype._reconnect = function()
@@ -27,45 +48,116 @@ OPC.prototype._reconnect = function()
     this.socket = new net.Socket()
     this.connected = false;
 
-    this.socket.onclose = function() {
-        console.log("Connection closed");
+    this.socket.on('close', function() {
+        if (_this.connected) {
+            console.log("Connection closed");
+        }
+        _this.retryAt = Date.now() + _this.retryWait;
+        _this.retryWait = Math.min(_this.retryWait * 2, RECONNECT_MAX);
         _this.socket = null;
         _this.connected = false;
-    }
+        _this.lastHash = null;
+
+        // Writes still queued on the dead socket may never release their buffers
+        if (_this.pixelBuffer) {
+            _this._allocateBuffers(_this.pixelBuffer.length);
+        }
+    });
 
-    this.socket.connect(this.port, this.host, function() {
-        console.log("Connected to " + _this.socket.remoteAddress);
+    var onConnect = function() {
+        console.log("Connected to " + (_this.socket.remoteAddress || _this.host));
         _this.connected = true;
+        _this.retryWait = RECONNECT_MIN;
         _this.socket.setNoDelay();
-    });
+    };
+
+    if (this.port) {
+        this.socket.connect(this.port, this.host, onConnect);
+    } else {
+        this.socket.connect(this.host, onConnect);
+    }
 
     this.socket.on('error', function( error ) {
-      console.log("Error with connection " + _this.host + ":" + _this.port + " " + error);
+      if (_this.connected || _this.retryWait == RECONNECT_MIN) {
+        console.log("Error with connection " + _this.host + ":" + _this.port + " " + error);
+      }
     });
 }
 
 OPC.prototype.writePixels = function()
 {
-    if (!this.socket) {
+    // Send the current frame. The socket keeps a reference to the buffer it was given
+    // until the write completes, so ownership passes to it and the next free buffer
+    // becomes 'pixelBuffer'. That buffer holds an older frame: callers must set every
+    // pixel before the next write. If every other buffer is still queued, the frame is
+    // dropped and composing continues into the same buffer. Returns true if sent.
+
+    if (!this.socket && Date.now() >= this.retryAt) {
         this._reconnect();
     }
     if (!this.connected) {
-        return;
+        return false;
+    }
+
+    var hash = null;
+    if (this.skipUnchanged) {
+        hash = frameHash(this.pixelBuffer);
+        if (hash === this.lastHash) {
+            this.framesSkipped++;
+            return false;
+        }
+    }
+
+    var next = this.freeBuffers.pop();
+    if (!next) {
+        this.framesDropped++;
+        return false;
     }
-    this.socket.write(this.pixelBuffer);
+
+    var _this = this;
+    var sent = this.pixelBuffer;
+    var generation = this.generation;
+
+    this.pixelBuffer = next;
+    this.lastHash = hash;
+    this.socket.write(sent, function() {
+        if (generation == _this.generation) {
+            _this.freeBuffers.push(sent);
+        }
+    });
+    return true;
 }
 
 OPC.prototype.setPixelCount = function(num)
 {
     var length = 4 + num*3;
     if (this.pixelBuffer == null || this.pixelBuffer.length != length) {
-        this.pixelBuffer = new Buffer(length);
+        this._allocateBuffers(length);
+    }
+}
+
+OPC.prototype._allocateBuffers = function(length)
+{
+    // (Re)build the packet buffer pool. Buffers still owned by the socket belong to
+    // the previous generation and are discarded when their writes complete.
+
+    this.generation++;
+    this.pixelBuffer = this._packet(length);
+    this.freeBuffers = [];
+    for (var i = 1; i < this.bufferCount; i++) {
+        this.freeBuffers.push(this._packet(length));
     }
+}
+
+OPC.prototype._packet = function(length)
+{
+    var buffer = Buffer.alloc ? Buffer.alloc(length) : new Buffer(length).fill(0);
 
     // Initialize OPC header
-    this.pixelBuffer.writeUInt8(0, 0);           // Channel
-    this.pixelBuffer.writeUInt8(0, 1);           // Command
-    this.pixelBuffer.writeUInt16BE(num * 3, 2);  // Length
+    buffer.writeUInt8(0, 0);                  // Channel
+    buffer.writeUInt8(0, 1);                  // Command
+    buffer.writeUInt16BE(length - 4, 2);      // Length
+    return buffer;
 }
 
 OPC.prototype.setPixel = function(num, r, g, b)
@@ -86,7 +178,7 @@ OPC.prototype.mapPixels = function(fn, model)
     // corresponding pixel value. The function returns a tuple of three 8-bit RGB values.
     // Implies 'writePixels' as well. Has no effect if the OPC client is disconnected.
 
-    if (!this.socket) {
+    if (!this.socket && Date.now() >= this.retryAt) {
         this._reconnect();
     }
     if (!this.connected) {
@@ -110,6 +202,61 @@ OPC.prototype.mapPixels = function(fn, model)
     this.writePixels();
 }
 
+OPC.prototype.mapCompiledPixels = function(fn, model, rgb)
+{
+    // Like mapPixels, but for a model produced by OPC.compileModel. Instead of returning
+    // a new array per pixel, "fn" is called as fn(points, offset, rgb) and writes its
+    // three RGB values into "rgb", which the caller may supply to avoid any allocation.
+    // Has no effect if the OPC client is disconnected.
+
+    if (!this.socket && Date.now() >= this.retryAt) {
+        this._reconnect();
+    }
+    if (!this.connected) {
+        return;
+    }
+
+    rgb = rgb || new Float32Array(3);
+
+    this.setPixelCount(model.length);
+    var buffer = this.pixelBuffer;
+    var points = model.points;
+    var index = model.index;
+    var offset = 4;
+
+    for (var i = 0; i < model.length; i++) {
+        var p = index[i];
+        if (p < 0) {
+            // Unused channel (null model)
+            buffer[offset] = buffer[offset + 1] = buffer[offset + 2] = 0;
+        } else {
+            fn(points, p, rgb);
+            buffer[offset] = clampByte(rgb[0]);
+            buffer[offset + 1] = clampByte(rgb[1]);
+            buffer[offset + 2] = clampByte(rgb[2]);
+        }
+        offset += 3;
+    }
+
+    this.writePixels();
+}
+
+function frameHash(buffer)
+{
+    // 32-bit FNV-1a over the whole packet
+    var h = 0x811c9dc5;
+    for (var i = 0; i < buffer.length; i++) {
+        h = Math.imul(h ^ buffer[i], 0x01000193);
+    }
+    return h >>> 0;
+}
+
+function clampByte(v)
+{
+    v = v | 0;
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
 
 /********************************************************************************
  * Client convenience methods
@@ -149,6 +296,45 @@ OPC.prototype.mapParticles = function(particles, model)
     this.mapPixels(shader, model);
 }
 
+OPC.prototype.mapCompiledParticles = function(particles, model)
+{
+    // Same as mapParticles, for a compiled model. The shader accumulates straight into
+    // a reused output array, so no garbage is produced per pixel.
+
+    function shader(points, p, rgb) {
+        var x = points[p];
+        var y = points[p + 1];
+        var z = points[p + 2];
+        var r = 0;
+        var g = 0;
+        var b = 0;
+
+        for (var i = 0; i < particles.length; i++) {
+            var particle = particles[i];
+
+            // Particle to sample distance
+            var dx = (x - particle.point[0]) || 0;
+            var dy = (y - particle.point[1]) || 0;
+            var dz = (z - particle.point[2]) || 0;
+            var dist2 = dx * dx + dy * dy + dz * dz;
+
+            // Particle edge falloff
+            var intensity = particle.intensity / (1 + particle.falloff * dist2);
+
+            // Intensity scaling
+            r += particle.color[0] * intensity;
+            g += particle.color[1] * intensity;
+            b += particle.color[2] * intensity;
+        }
+
+        rgb[0] = r;
+        rgb[1] = g;
+        rgb[2] = b;
+    }
+
+    this.mapCompiledPixels(shader, model, this._rgb || (this._rgb = new Float32Array(3)));
+}
+
 
 /********************************************************************************
  * Global convenience methods
@@ -160,6 +346,46 @@ OPC.loadModel = function(filename)
     return JSON.parse(fs.readFileSync(filename))
 }
 
+OPC.compileModel = function(model)
+{
+    /*
+     * Converts a parsed JSON layout into flat typed arrays.
+     *
+     * 'points' holds x, y, z for every LED that has a position, packed with no gaps.
+     * 'index' has one entry per OPC channel: the offset of that LED's x coordinate
+     * in 'points', or -1 for null/unused channels. 'length' is the channel count,
+     * 'count' the number of positioned LEDs.
+     */
+
+    var length = model.length;
+    var index = new Int32Array(length);
+    var count = 0;
+
+    for (var i = 0; i < length; i++) {
+        index[i] = (model[i] && model[i].point) ? 3 * count++ : -1;
+    }
+
+    var points = new Float32Array(3 * count);
+
+    for (var i = 0; i < length; i++) {
+        var p = index[i];
+        if (p >= 0) {
+            var point = model[i].point;
+            points[p] = point[0] || 0;
+            points[p + 1] = point[1] || 0;
+            points[p + 2] = point[2] || 0;
+        }
+    }
+
+    return { length: length, count: count, points: points, index: index };
+}
+
+OPC.loadCompiledModel = function(filename)
+{
+    // Load a JSON model from disk and compile it for mapCompiledPixels
+    return OPC.compileModel(OPC.loadModel(filename));
+}
+
 OPC.hsv = function(h, s, v)
 {
     /*